@@ -1,15 +1,27 @@
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
 #include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
 #include <exception>
 #include <functional>
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <mutex>
 #include <numeric>
+#include <optional>
+#include <queue>
+#include <random>
+#include <shared_mutex>
 #include <string>
 #include <syncstream>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 using namespace std::chrono_literals;
 
@@ -18,7 +30,7 @@ using namespace std::chrono_literals;
 // 任何 std::atomic 类型，初始化不是原子操作
 // 未定义行为优化(ub优化) : 优化会假设程序中没有未定义行为
 
-#define VERSION_7
+#define VERSION_14
 #ifdef VERSION_1
 
 #if 0
@@ -483,4 +495,1872 @@ int main()
     std::jthread t{wait_for_wake_up};
     wake_up();
 }
+#elif defined(VERSION_8)
+// VERSION_3 的 spinlock_mutex 在 test_and_set 上空转：
+// test_and_set 是读-改-写操作，每次都要以独占方式获取缓存行，所有等待者不停地互相抢夺同一缓存行，核心越多越慢
+
+// test-and-test-and-set（TTAS）：
+/*
+1: 先用普通的 load（atomic_flag::test，C++20）观察锁的状态，锁被持有时只读，缓存行在各个核心中以共享状态存在，不产生总线流量
+2: 观察到锁空闲时才尝试 test_and_set
+3: 尝试失败说明有其它线程同时在抢，此时指数退避：等待 1、2、4... 次 pause 再重试，上限之后让出时间片
+*/
+// pause 指令提示 CPU 当前处于自旋等待：降低功耗，避免退出循环时因内存序冲突清空流水线，也让出超线程的执行资源
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+inline void cpu_relax() noexcept { _mm_pause(); }
+#elif defined(__aarch64__)
+inline void cpu_relax() noexcept { asm volatile("yield"); }
+#else
+inline void cpu_relax() noexcept {}
+#endif
+
+class spinlock_mutex
+{
+    std::atomic_flag flag{};
+
+public:
+    spinlock_mutex() noexcept = default;
+    void lock() noexcept
+    {
+        while (flag.test_and_set(std::memory_order_acquire))
+            ;
+    }
+
+    void unlock() noexcept
+    {
+        flag.clear(std::memory_order_release);
+    }
+};
+
+class ttas_spinlock_mutex
+{
+    static constexpr std::uint32_t max_backoff = 1024; // 退避上限（pause 次数）
+
+    std::atomic_flag flag{};
+
+public:
+    ttas_spinlock_mutex() noexcept = default;
+    ttas_spinlock_mutex(const ttas_spinlock_mutex &) = delete;
+    ttas_spinlock_mutex &operator=(const ttas_spinlock_mutex &) = delete;
+
+    void lock() noexcept
+    {
+        for (std::uint32_t backoff = 1;; backoff = std::min(backoff * 2, max_backoff))
+        {
+            if (try_lock())
+                return;
+            for (std::uint32_t i = 0; i < backoff; ++i)
+                cpu_relax();
+            // 退避到上限仍拿不到锁，说明持有者可能被调度走了（线程数多于核心数），继续空转没有意义
+            if (backoff == max_backoff)
+                std::this_thread::yield();
+        }
+    }
+
+    // 满足 Lockable 要求，可以用于 std::unique_lock 的 try_to_lock、std::scoped_lock 等
+    bool try_lock() noexcept
+    {
+        return !flag.test(std::memory_order_relaxed) && !flag.test_and_set(std::memory_order_acquire);
+    }
+
+    void unlock() noexcept
+    {
+        flag.clear(std::memory_order_release);
+    }
+};
+
+// 每个线程反复加锁，对共享计数器自增。临界区极短，测量的几乎全是锁本身在竞争下的开销
+template <typename Mutex>
+double contention_benchmark(std::size_t num_threads, std::size_t iterations)
+{
+    Mutex m;
+    std::size_t counter = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t i = 0; i < num_threads; ++i)
+            threads.emplace_back([&]
+                                 {
+                for (std::size_t j = 0; j < iterations; ++j)
+                {
+                    std::lock_guard<Mutex> lk{m};
+                    ++counter;
+                } });
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    assert(counter == num_threads * iterations);
+    return num_threads * iterations / elapsed.count() / 1e6; // 百万次加锁/秒
+}
+
+int main()
+{
+    ttas_spinlock_mutex m;
+    {
+        std::unique_lock<ttas_spinlock_mutex> lk{m, std::try_to_lock};
+        std::cout << std::boolalpha << lk.owns_lock() << '\n'; // true
+        std::cout << m.try_lock() << '\n';                      // false 已被持有
+    }
+
+    constexpr std::size_t iterations = 200'000;
+    std::size_t max_threads = std::max(4u, std::thread::hardware_concurrency());
+    std::cout << "线程数\tspinlock\tttas\tstd::mutex（百万次/秒）\n";
+    for (std::size_t n = 1; n <= max_threads; n *= 2)
+    {
+        std::cout << n << '\t'
+                  << contention_benchmark<spinlock_mutex>(n, iterations) << '\t'
+                  << contention_benchmark<ttas_spinlock_mutex>(n, iterations) << '\t'
+                  << contention_benchmark<std::mutex>(n, iterations) << '\n';
+    }
+}
+#elif defined(VERSION_9)
+// 公平性：spinlock_mutex 不保证先来先得，释放锁时谁抢到 test_and_set 谁获得锁，运气差的线程可能长时间饿死（尾延迟尖刺）
+// 并且所有等待者都在同一个 atomic_flag 上自旋，每次释放都引起一次所有核心之间的缓存行风暴
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+inline void cpu_relax() noexcept { _mm_pause(); }
+#elif defined(__aarch64__)
+inline void cpu_relax() noexcept { asm volatile("yield"); }
+#else
+inline void cpu_relax() noexcept {}
+#endif
+
+// 自旋一段时间仍未等到，让出时间片（线程数多于核心数时，持有者或下一个获得者可能正处于未被调度的状态）
+constexpr std::uint32_t spins_before_yield = 1024;
+
+inline void spin_wait(std::uint32_t &spins) noexcept
+{
+    if (++spins < spins_before_yield)
+        cpu_relax();
+    else
+        std::this_thread::yield();
+}
+
+// 避免伪共享：不同线程频繁写入的原子变量放在不同的缓存行中
+constexpr std::size_t cache_line_size = 64;
+
+class spinlock_mutex
+{
+    std::atomic_flag flag{};
+
+public:
+    spinlock_mutex() noexcept = default;
+    void lock() noexcept
+    {
+        while (flag.test_and_set(std::memory_order_acquire))
+            ;
+    }
+
+    void unlock() noexcept
+    {
+        flag.clear(std::memory_order_release);
+    }
+};
+
+// 排队锁（ticket lock）：类似银行取号
+/*
+1: lock 时 fetch_add 取一个号，然后等待“正在服务”的号等于自己的号
+2: unlock 时将“正在服务”的号加一
+严格按照取号顺序（FIFO）获得锁，不会饿死。但所有等待者仍在同一个 serving_ 上自旋
+注意：线程数多于核心数时，轮到的那个线程若没有被调度，排在后面的所有线程都只能等它（护航效应），FIFO 锁的吞吐会急剧下降
+*/
+class ticket_lock
+{
+    alignas(cache_line_size) std::atomic<std::uint32_t> next_{0};
+    alignas(cache_line_size) std::atomic<std::uint32_t> serving_{0};
+
+public:
+    ticket_lock() noexcept = default;
+    ticket_lock(const ticket_lock &) = delete;
+    ticket_lock &operator=(const ticket_lock &) = delete;
+
+    void lock() noexcept
+    {
+        const std::uint32_t ticket = next_.fetch_add(1, std::memory_order_relaxed);
+        std::uint32_t spins = 0;
+        while (serving_.load(std::memory_order_acquire) != ticket)
+            spin_wait(spins);
+    }
+
+    // 只有在没有人排队时（next_ == serving_）才能取号成功
+    bool try_lock() noexcept
+    {
+        std::uint32_t serving = serving_.load(std::memory_order_acquire);
+        std::uint32_t expected = serving;
+        return next_.compare_exchange_strong(expected, serving + 1, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    // 只有持有者会修改 serving_，因此读取后再写入不需要读-改-写操作
+    void unlock() noexcept
+    {
+        serving_.store(serving_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+// MCS 队列锁：等待者组成一个链表，每个等待者只在自己的节点上自旋
+/*
+1: lock 时将自己的节点 exchange 到队尾，如果之前有队尾（前驱），就把自己挂到前驱的 next 上，然后只观察自己节点的 locked
+2: unlock 时如果有后继，就清除后继节点的 locked 将锁直接交给它；没有后继则尝试把队尾置空
+每次交接只写一个等待者的缓存行，不会引起所有核心的缓存行风暴，同时也是 FIFO 的
+*/
+class mcs_lock
+{
+    struct alignas(cache_line_size) node
+    {
+        std::atomic<node *> next{nullptr};
+        std::atomic_bool locked{false};
+    };
+
+    // Lockable 的 lock() 没有参数，节点从线程局部的缓存中获取，线程可以同时持有多个 mcs_lock
+    // 线程退出时不能仍持有 mcs_lock
+    struct node_cache
+    {
+        std::vector<std::unique_ptr<node>> nodes;
+        std::vector<node *> free;
+
+        node *acquire()
+        {
+            if (free.empty())
+                return nodes.emplace_back(std::make_unique<node>()).get();
+            node *n = free.back();
+            free.pop_back();
+            return n;
+        }
+        void release(node *n) { free.push_back(n); }
+    };
+    static node_cache &cache()
+    {
+        thread_local node_cache c;
+        return c;
+    }
+
+    alignas(cache_line_size) std::atomic<node *> tail_{nullptr};
+    node *owner_ = nullptr; // 只有持有锁的线程读写
+
+public:
+    mcs_lock() noexcept = default;
+    mcs_lock(const mcs_lock &) = delete;
+    mcs_lock &operator=(const mcs_lock &) = delete;
+
+    void lock()
+    {
+        node *me = cache().acquire();
+        me->next.store(nullptr, std::memory_order_relaxed);
+        me->locked.store(true, std::memory_order_relaxed);
+
+        node *pred = tail_.exchange(me, std::memory_order_acq_rel);
+        if (pred)
+        {
+            pred->next.store(me, std::memory_order_release);
+            std::uint32_t spins = 0;
+            while (me->locked.load(std::memory_order_acquire))
+                spin_wait(spins);
+        }
+        owner_ = me;
+    }
+
+    bool try_lock()
+    {
+        node *me = cache().acquire();
+        me->next.store(nullptr, std::memory_order_relaxed);
+        node *expected = nullptr;
+        if (tail_.compare_exchange_strong(expected, me, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            owner_ = me;
+            return true;
+        }
+        cache().release(me);
+        return false;
+    }
+
+    void unlock()
+    {
+        node *me = owner_;
+        node *next = me->next.load(std::memory_order_acquire);
+        if (!next)
+        {
+            node *expected = me;
+            if (tail_.compare_exchange_strong(expected, nullptr, std::memory_order_release, std::memory_order_relaxed))
+            {
+                cache().release(me);
+                return;
+            }
+            // 有新的等待者已经 exchange 到了队尾，但还没来得及挂到 me->next 上，等它挂好
+            while (!(next = me->next.load(std::memory_order_acquire)))
+                cpu_relax();
+        }
+        next->locked.store(false, std::memory_order_release);
+        cache().release(me); // 交接之后不会再有线程访问 me
+    }
+};
+
+struct benchmark_result
+{
+    double throughput;  // 百万次加锁/秒
+    double p99_ns;      // 获取锁的等待时间的 99 分位数
+    double max_ns;
+};
+
+template <typename Mutex>
+benchmark_result lock_benchmark(std::size_t num_threads, std::size_t iterations)
+{
+    Mutex m;
+    std::size_t counter = 0;
+    std::vector<std::vector<std::int64_t>> latencies(num_threads);
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t i = 0; i < num_threads; ++i)
+            threads.emplace_back([&, i]
+                                 {
+                auto &samples = latencies[i];
+                samples.reserve(iterations);
+                for (std::size_t j = 0; j < iterations; ++j)
+                {
+                    auto before = std::chrono::steady_clock::now();
+                    std::lock_guard<Mutex> lk{m};
+                    samples.push_back((std::chrono::steady_clock::now() - before).count());
+                    ++counter;
+                } });
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    assert(counter == num_threads * iterations);
+
+    std::vector<std::int64_t> all;
+    for (auto &samples : latencies)
+        all.insert(all.end(), samples.begin(), samples.end());
+    auto p99 = all.begin() + all.size() * 99 / 100;
+    std::nth_element(all.begin(), p99, all.end());
+    using ns = std::chrono::duration<double, std::nano>;
+    return {num_threads * iterations / elapsed.count() / 1e6,
+            ns{std::chrono::steady_clock::duration{*p99}}.count(),
+            ns{std::chrono::steady_clock::duration{*std::max_element(all.begin(), all.end())}}.count()};
+}
+
+template <typename Mutex>
+void report(const char *name, std::size_t num_threads, std::size_t iterations)
+{
+    auto [throughput, p99, max] = lock_benchmark<Mutex>(num_threads, iterations);
+    std::cout << "  " << name << "\t" << throughput << " M/s\tp99: " << p99 << " ns\tmax: " << max << " ns\n";
+}
+
+int main()
+{
+    {
+        mcs_lock a, b;
+        std::scoped_lock lk{a, b}; // 同一线程同时持有多个 mcs_lock
+        std::cout << std::boolalpha << a.try_lock() << '\n'; // false
+    }
+
+    constexpr std::size_t iterations = 100'000;
+    std::size_t max_threads = std::max(4u, std::thread::hardware_concurrency());
+    for (std::size_t n = 1; n <= max_threads; n *= 2)
+    {
+        std::cout << n << " 个线程:\n";
+        report<spinlock_mutex>("spinlock", n, iterations);
+        report<ticket_lock>("ticket  ", n, iterations);
+        report<mcs_lock>("mcs     ", n, iterations);
+        report<std::mutex>("std::mutex", n, iterations);
+    }
+}
+#elif defined(VERSION_10)
+// 自旋锁响应快但浪费 CPU，睡眠锁节省资源但每次阻塞/唤醒都要进入内核。混合锁两者兼顾：先短暂自旋，等不到再睡眠
+/*
+三态锁（参考 Ulrich Drepper《Futexes Are Tricky》）：
+0 unlocked   未上锁
+1 locked     已上锁，没有线程在睡眠等待
+2 contended  已上锁，可能有线程在睡眠等待
+1: lock 先 CAS 0 -> 1，成功直接返回；失败则自旋一段时间，仍然拿不到就把状态设为 2，并在 atomic::wait 上睡眠
+2: unlock 将状态 exchange 为 0，只有旧值为 2 时才 notify_one。没有竞争时 unlock 只是一条原子指令，不会进入内核
+C++20 的 atomic::wait/notify 在 Linux 上通常直接基于 futex 实现，在 Windows 上基于 WaitOnAddress
+*/
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+inline void cpu_relax() noexcept { _mm_pause(); }
+#elif defined(__aarch64__)
+inline void cpu_relax() noexcept { asm volatile("yield"); }
+#else
+inline void cpu_relax() noexcept {}
+#endif
+
+class hybrid_mutex
+{
+    enum : std::uint32_t
+    {
+        unlocked,
+        locked,
+        contended
+    };
+    static constexpr std::uint32_t min_spin = 16;
+    static constexpr std::uint32_t max_spin = 4096;
+
+    std::atomic<std::uint32_t> state_{unlocked};
+    // 自旋的次数预算，是对“锁的剩余持有时间”的估计（以 pause 次数计）：
+    // 自旋中等到了锁，就向实际等待次数的两倍靠拢；自旋白白浪费了，说明持有时间比预算长，预算减半
+    std::atomic<std::uint32_t> spin_budget_{100};
+
+    void adapt(std::uint32_t observed) noexcept
+    {
+        std::uint32_t budget = spin_budget_.load(std::memory_order_relaxed);
+        std::uint32_t target = observed == max_spin ? budget / 2 : observed * 2;
+        budget = static_cast<std::uint32_t>(budget + (static_cast<std::int64_t>(target) - budget) / 8); // 指数移动平均
+        spin_budget_.store(std::clamp(budget, min_spin, max_spin), std::memory_order_relaxed);
+    }
+
+public:
+    hybrid_mutex() noexcept = default;
+    hybrid_mutex(const hybrid_mutex &) = delete;
+    hybrid_mutex &operator=(const hybrid_mutex &) = delete;
+
+    void lock() noexcept
+    {
+        std::uint32_t c = unlocked;
+        if (state_.compare_exchange_strong(c, locked, std::memory_order_acquire, std::memory_order_relaxed))
+            return;
+
+        // 自旋阶段：只读地观察，看到锁空闲再尝试 CAS
+        const std::uint32_t budget = spin_budget_.load(std::memory_order_relaxed);
+        for (std::uint32_t i = 0; i < budget; ++i)
+        {
+            cpu_relax();
+            c = state_.load(std::memory_order_relaxed);
+            if (c == unlocked && state_.compare_exchange_weak(c, locked, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                adapt(i + 1);
+                return;
+            }
+        }
+        adapt(max_spin);
+
+        // 睡眠阶段：将状态标记为 contended，表示有人在等，持有者 unlock 时必须唤醒
+        // 醒来后抢到锁时同样设为 contended，因为无法知道是否还有其它等待者（保守，最多多一次 notify）
+        if (c != contended)
+            c = state_.exchange(contended, std::memory_order_acquire);
+        while (c != unlocked)
+        {
+            state_.wait(contended, std::memory_order_relaxed); // 状态不为 contended 时立即返回
+            c = state_.exchange(contended, std::memory_order_acquire);
+        }
+    }
+
+    bool try_lock() noexcept
+    {
+        std::uint32_t c = unlocked;
+        return state_.compare_exchange_strong(c, locked, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock() noexcept
+    {
+        if (state_.exchange(unlocked, std::memory_order_release) == contended)
+            state_.notify_one();
+    }
+
+    std::uint32_t spin_budget() const noexcept { return spin_budget_.load(std::memory_order_relaxed); }
+};
+
+// hybrid_mutex 满足 Lockable，配合 std::condition_variable_any 即可替换 std::mutex + std::condition_variable
+// Thread_Pool 与 threadsafe_queue 的互斥量都只用于 lock_guard/unique_lock 与条件变量，同样可以直接替换
+template <typename T, typename Mutex = hybrid_mutex>
+class threadsafe_queue
+{
+    mutable Mutex m;
+    std::condition_variable_any data_cond;
+    std::queue<T> data_queue;
+
+public:
+    void push(T new_value)
+    {
+        {
+            std::lock_guard<Mutex> lk{m};
+            data_queue.push(std::move(new_value));
+        }
+        data_cond.notify_one();
+    }
+    void pop(T &value)
+    {
+        std::unique_lock<Mutex> lk{m};
+        data_cond.wait(lk, [this]
+                       { return !data_queue.empty(); });
+        value = std::move(data_queue.front());
+        data_queue.pop();
+    }
+    bool empty() const
+    {
+        std::lock_guard<Mutex> lk{m};
+        return data_queue.empty();
+    }
+};
+
+template <typename Mutex>
+double contention_benchmark(std::size_t num_threads, std::size_t iterations, std::chrono::nanoseconds hold)
+{
+    Mutex m;
+    std::size_t counter = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t i = 0; i < num_threads; ++i)
+            threads.emplace_back([&]
+                                 {
+                for (std::size_t j = 0; j < iterations; ++j)
+                {
+                    std::lock_guard<Mutex> lk{m};
+                    ++counter;
+                    for (auto until = std::chrono::steady_clock::now() + hold; std::chrono::steady_clock::now() < until;)
+                        ; // 模拟临界区持有时间
+                } });
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    assert(counter == num_threads * iterations);
+    return num_threads * iterations / elapsed.count() / 1e6;
+}
+
+template <typename Mutex>
+double queue_benchmark(std::size_t items)
+{
+    threadsafe_queue<std::size_t, Mutex> q;
+    std::size_t total = 0;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::jthread producer{[&]
+                              {
+            for (std::size_t i = 1; i <= items; ++i)
+                q.push(i); }};
+        std::jthread consumer{[&]
+                              {
+            for (std::size_t i = 0; i < items; ++i)
+            {
+                std::size_t v{};
+                q.pop(v);
+                total += v;
+            } }};
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    assert(total == items * (items + 1) / 2);
+    return items / elapsed.count() / 1e6;
+}
+
+int main()
+{
+    constexpr std::size_t iterations = 100'000;
+    std::size_t num_threads = std::max(4u, std::thread::hardware_concurrency());
+    for (auto hold : {0ns, 200ns, 2000ns})
+    {
+        std::cout << "临界区 " << hold.count() << "ns, " << num_threads << " 个线程（百万次/秒）: hybrid "
+                  << contention_benchmark<hybrid_mutex>(num_threads, iterations / (1 + hold.count() / 100), hold)
+                  << "\tstd::mutex " << contention_benchmark<std::mutex>(num_threads, iterations / (1 + hold.count() / 100), hold) << '\n';
+    }
+
+    std::cout << "threadsafe_queue（百万项/秒）: hybrid " << queue_benchmark<hybrid_mutex>(1'000'000)
+              << "\tstd::mutex " << queue_benchmark<std::mutex>(1'000'000) << '\n';
+}
+#elif defined(VERSION_11)
+// 顺序锁（seqlock）：用于体积小、读取极其频繁、很少写入的记录
+/*
+VERSION_6 中每次 data.load() 都要对 shared_ptr 的引用计数做原子读-改-写（libstdc++ 中还要经过内部的自旋锁），std::shared_mutex 则有读者计数的竞争
+seqlock 的读者从不写共享内存：
+1: 写者先将序号加一（变为奇数），写入数据，再将序号加一（变回偶数）
+2: 读者读取序号，为奇数说明正在写，重试；读取数据后再读一次序号，与之前不同说明读的过程中发生了写入，重试
+读者可能读到“撕裂”的中间状态，但一定会因序号不一致而丢弃。写者之间通过 CAS 序号互斥
+数据以原子的机器字保存并使用 relaxed 读写，这样并发读写数据在 C++ 内存模型中也不是数据竞争（参考 Hans Boehm《Can Seqlocks Get Along with Programming Language Memory Models?》）
+*/
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+inline void cpu_relax() noexcept { _mm_pause(); }
+#elif defined(__aarch64__)
+inline void cpu_relax() noexcept { asm volatile("yield"); }
+#else
+inline void cpu_relax() noexcept {}
+#endif
+
+template <typename T>
+class seqlock
+{
+    static_assert(std::is_trivially_copyable_v<T>, "seqlock 按字节复制数据，T 必须可平凡复制");
+    static_assert(std::is_default_constructible_v<T>);
+
+    using word = std::uintptr_t;
+    static constexpr std::size_t word_count = (sizeof(T) + sizeof(word) - 1) / sizeof(word);
+
+    std::atomic<std::uint64_t> seq_{0};
+    std::array<std::atomic<word>, word_count> data_{};
+
+public:
+    seqlock() noexcept { store(T{}); }
+    explicit seqlock(const T &value) noexcept { store(value); }
+    seqlock(const seqlock &) = delete;
+    seqlock &operator=(const seqlock &) = delete;
+
+    T load() const noexcept
+    {
+        std::array<word, word_count> copy;
+        std::uint64_t before;
+        for (;;)
+        {
+            before = seq_.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                cpu_relax();
+                continue;
+            }
+            for (std::size_t i = 0; i < word_count; ++i)
+                copy[i] = data_[i].load(std::memory_order_relaxed);
+            // 保证上面读取数据不会被重排到下面再次读取序号之后
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq_.load(std::memory_order_relaxed) == before)
+                break;
+        }
+        T result;
+        std::memcpy(static_cast<void *>(&result), copy.data(), sizeof(T));
+        return result;
+    }
+
+    void store(const T &value) noexcept
+    {
+        std::array<word, word_count> copy{};
+        std::memcpy(copy.data(), &value, sizeof(T));
+
+        std::uint64_t seq = seq_.load(std::memory_order_relaxed);
+        // 成功时用 acquire：与上一个写者释放序号的 release 同步，本次对数据的写入才排在上一个写者之后，
+        // 否则最终状态可能是上一个写者的数据配上本次的序号。下面的 release fence 只约束本写者自己的写入
+        while ((seq & 1) || !seq_.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire, std::memory_order_relaxed))
+        {
+            cpu_relax();
+            seq = seq_.load(std::memory_order_relaxed);
+        }
+        // 保证序号变为奇数先于数据的写入被其它线程看到
+        std::atomic_thread_fence(std::memory_order_release);
+        for (std::size_t i = 0; i < word_count; ++i)
+            data_[i].store(copy[i], std::memory_order_relaxed);
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+};
+
+// VERSION_6 中的 Data 扩展为一个小记录，字段之间满足不变式 ask == bid + 1，用于检测读者是否读到撕裂的数据
+struct Data
+{
+    std::int64_t version = 0;
+    double bid = 0;
+    double ask = 1;
+};
+
+class seqlock_data
+{
+    seqlock<Data> data_;
+
+public:
+    void store(const Data &d) { data_.store(d); }
+    Data load() const { return data_.load(); }
+};
+
+class shared_mutex_data
+{
+    Data data_;
+    mutable std::shared_mutex m_;
+
+public:
+    void store(const Data &d)
+    {
+        std::lock_guard<std::shared_mutex> lk{m_};
+        data_ = d;
+    }
+    Data load() const
+    {
+        std::shared_lock<std::shared_mutex> lk{m_};
+        return data_;
+    }
+};
+
+class atomic_shared_ptr_data
+{
+    std::atomic<std::shared_ptr<Data>> data_ = std::make_shared<Data>();
+
+public:
+    void store(const Data &d) { data_.store(std::make_shared<Data>(d)); }
+    Data load() const { return *data_.load(); }
+};
+
+// 与 VERSION_6 的 writer/reader 相同的模式：1 个写者持续更新，N 个读者在固定时间内尽可能多地读取
+template <typename Storage>
+double reader_benchmark(std::size_t num_readers, std::chrono::milliseconds duration)
+{
+    Storage storage;
+    std::atomic_bool stop{false};
+    std::atomic<std::uint64_t> total{0};
+    std::atomic_bool torn{false};
+    {
+        std::vector<std::jthread> threads;
+        threads.emplace_back([&]
+                             {
+            for (std::int64_t i = 1; !stop.load(std::memory_order_relaxed); ++i)
+            {
+                storage.store(Data{i, i * 0.5, i * 0.5 + 1});
+                std::this_thread::sleep_for(10us);
+            } });
+        for (std::size_t r = 0; r < num_readers; ++r)
+        {
+            threads.emplace_back([&]
+                                 {
+                std::uint64_t reads = 0;
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    Data d = storage.load();
+                    if (d.ask != d.bid + 1 || d.bid != d.version * 0.5)
+                        torn = true;
+                    ++reads;
+                }
+                total += reads; });
+        }
+        std::this_thread::sleep_for(duration);
+        stop = true;
+    }
+    assert(!torn);
+    return total / std::chrono::duration<double>(duration).count() / 1e6;
+}
+
+int main()
+{
+    seqlock<Data> data;
+    data.store(Data{1, 100, 101});
+    std::cout << data.load().ask << '\n'; // 101
+
+    std::size_t max_readers = std::max(4u, std::thread::hardware_concurrency());
+    std::cout << "读者数\tshared_mutex\tatomic<shared_ptr>\tseqlock（百万次读/秒）\n";
+    for (std::size_t n = 1; n <= max_readers; n *= 2)
+    {
+        std::cout << n << '\t' << reader_benchmark<shared_mutex_data>(n, 300ms)
+                  << '\t' << reader_benchmark<atomic_shared_ptr_data>(n, 300ms)
+                  << '\t' << reader_benchmark<seqlock_data>(n, 300ms) << '\n';
+    }
+}
+#elif defined(VERSION_12)
+// 无锁的原子共享指针：分离引用计数（split reference count）
+/*
+libstdc++ 的 std::atomic<std::shared_ptr> 不是无锁的（is_lock_free() 返回 false），每次 load() 都要经过一个内部自旋锁
+分离引用计数：
+1: 内部计数（internal count）保存在控制块中，即普通的引用计数
+2: 外部计数（external count）与指针打包在同一个原子字中，读者用一次 CAS 递增外部计数“占住”指针，这一次递增就相当于持有一个引用
+3: 读者归还时总是从控制块的内部计数中减一，从不把原子字上的外部计数减回去；写者替换指针时，将旧字累计的外部计数一次性转移到内部计数上
+   原子字只会被递增外部计数或整体替换，不存在“同一个控制块被重新存入后，读者减掉了新字的外部计数”这样的 ABA 问题
+   为了让内部计数在转移之前不会被读者减到 0，原子字持有的不是 1 个而是 bias 个内部计数，替换时再扣除；外部计数达到上限时由把它推到上限的读者转移到内部计数上清零
+x86-64 与 aarch64 的用户态地址只用到低 48 位，外部计数放在高 16 位，这样只需要 64 位的 CAS 就能保证无锁（128 位的 std::atomic 在 GCC 中要经过 libatomic，同样不是无锁的）
+*/
+
+template <typename T>
+class rc_ptr;
+template <typename T>
+class atomic_rc_ptr;
+
+template <typename T>
+struct rc_control
+{
+    std::atomic<std::int64_t> refs{1};
+    T value;
+
+    template <typename... Args>
+    explicit rc_control(Args &&...args) : value(std::forward<Args>(args)...) {}
+
+    // delta 可以为负数，返回 true 表示引用计数归零
+    bool add_refs(std::int64_t delta) noexcept
+    {
+        if (refs.fetch_add(delta, std::memory_order_acq_rel) + delta == 0)
+        {
+            delete this;
+            return true;
+        }
+        return false;
+    }
+};
+
+// 一个最简单的引用计数智能指针，作用相当于 std::shared_ptr
+template <typename T>
+class rc_ptr
+{
+    rc_control<T> *ctl_ = nullptr;
+
+    explicit rc_ptr(rc_control<T> *ctl) noexcept : ctl_(ctl) {}
+
+    template <typename U, typename... Args>
+    friend rc_ptr<U> make_rc(Args &&...args);
+    friend class atomic_rc_ptr<T>;
+
+public:
+    rc_ptr() noexcept = default;
+    rc_ptr(const rc_ptr &other) noexcept : ctl_(other.ctl_)
+    {
+        if (ctl_)
+            ctl_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    rc_ptr(rc_ptr &&other) noexcept : ctl_(std::exchange(other.ctl_, nullptr)) {}
+    rc_ptr &operator=(rc_ptr other) noexcept
+    {
+        std::swap(ctl_, other.ctl_);
+        return *this;
+    }
+    ~rc_ptr()
+    {
+        if (ctl_)
+            ctl_->add_refs(-1);
+    }
+
+    T *get() const noexcept { return ctl_ ? &ctl_->value : nullptr; }
+    T &operator*() const noexcept { return ctl_->value; }
+    T *operator->() const noexcept { return &ctl_->value; }
+    explicit operator bool() const noexcept { return ctl_ != nullptr; }
+};
+
+template <typename T, typename... Args>
+rc_ptr<T> make_rc(Args &&...args)
+{
+    return rc_ptr<T>(new rc_control<T>(std::forward<Args>(args)...));
+}
+
+template <typename T>
+class atomic_rc_ptr
+{
+    static_assert(sizeof(void *) == 8, "外部计数打包在 64 位指针的高 16 位中");
+
+    static constexpr int count_shift = 48;
+    static constexpr std::uint64_t pointer_mask = (std::uint64_t{1} << count_shift) - 1;
+    static constexpr std::uint64_t one_external = std::uint64_t{1} << count_shift;
+    static constexpr std::uint64_t max_external = 0xffff;
+    // 原子字持有的内部计数，必须大于外部计数的上限：内部计数 >= 其它引用 + bias - 尚未转移的外部计数 > 0
+    static constexpr std::int64_t bias = std::int64_t{1} << 32;
+
+    // 读者也要修改外部计数，因此 load() 虽是 const 成员函数仍要写原子字
+    mutable std::atomic<std::uint64_t> word_{0};
+
+    static rc_control<T> *control(std::uint64_t word) noexcept
+    {
+        return reinterpret_cast<rc_control<T> *>(word & pointer_mask);
+    }
+    static std::uint64_t external(std::uint64_t word) noexcept { return word >> count_shift; }
+    // 存入原子字：desired 持有的 1 个内部计数换成 bias 个
+    static std::uint64_t install(rc_control<T> *ctl) noexcept
+    {
+        auto bits = reinterpret_cast<std::uint64_t>(ctl);
+        assert((bits & ~pointer_mask) == 0);
+        if (ctl)
+            ctl->refs.fetch_add(bias - 1, std::memory_order_relaxed);
+        return bits;
+    }
+
+    // 递增外部计数，返回递增之后的字中的控制块，调用者因此持有一个引用
+    rc_control<T> *acquire_external() const noexcept
+    {
+        std::uint64_t word = word_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            if (!control(word))
+                return nullptr;
+            if (external(word) == max_external)
+            {
+                // 正由把计数推到上限的读者清零，等它完成
+                std::this_thread::yield();
+                word = word_.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (!word_.compare_exchange_weak(word, word + one_external,
+                                             std::memory_order_acquire, std::memory_order_relaxed))
+                continue;
+            word += one_external;
+            if (external(word) == max_external)
+                flush_external(word);
+            return control(word);
+        }
+    }
+
+    // 外部计数达到上限：只有把它推到上限的读者执行，它自己持有的引用保证控制块此时仍然存活
+    // 先把计数加到内部计数上，再把字清零；如果字在此期间被替换，retire/exchange 已经转移过这些计数，撤销刚才的加法
+    // 清零之前写者看到的总是上限值，内部计数不会被少算；同一控制块被重新存入后又到达上限时，被清零的计数同样已经加过
+    void flush_external(std::uint64_t word) const noexcept
+    {
+        rc_control<T> *ctl = control(word);
+        ctl->refs.fetch_add(static_cast<std::int64_t>(max_external), std::memory_order_relaxed);
+        if (!word_.compare_exchange_strong(word, word & pointer_mask, std::memory_order_relaxed))
+            ctl->add_refs(-static_cast<std::int64_t>(max_external));
+    }
+
+    // 替换后把累计的外部计数转移给旧控制块，并扣除原子字持有的 bias 个内部计数
+    static void retire(std::uint64_t old_word) noexcept
+    {
+        if (auto *ctl = control(old_word))
+            ctl->add_refs(static_cast<std::int64_t>(external(old_word)) - bias);
+    }
+
+public:
+    atomic_rc_ptr() noexcept = default;
+    explicit atomic_rc_ptr(rc_ptr<T> desired) noexcept : word_(install(std::exchange(desired.ctl_, nullptr))) {}
+    atomic_rc_ptr(const atomic_rc_ptr &) = delete;
+    atomic_rc_ptr &operator=(const atomic_rc_ptr &) = delete;
+    ~atomic_rc_ptr() { retire(word_.load(std::memory_order_relaxed)); }
+
+    bool is_lock_free() const noexcept { return word_.is_lock_free(); }
+
+    // 外部计数占住的引用直接交给返回值，只需要一次 CAS
+    rc_ptr<T> load() const noexcept { return rc_ptr<T>(acquire_external()); }
+
+    rc_ptr<T> exchange(rc_ptr<T> desired) noexcept
+    {
+        std::uint64_t old_word = word_.exchange(install(std::exchange(desired.ctl_, nullptr)), std::memory_order_acq_rel);
+        rc_control<T> *ctl = control(old_word);
+        if (!ctl)
+            return {};
+        // 原子字持有的 bias 个内部计数中保留 1 个交给返回值
+        ctl->refs.fetch_add(static_cast<std::int64_t>(external(old_word)) - bias + 1, std::memory_order_relaxed);
+        return rc_ptr<T>(ctl);
+    }
+
+    void store(rc_ptr<T> desired) noexcept
+    {
+        retire(word_.exchange(install(std::exchange(desired.ctl_, nullptr)), std::memory_order_acq_rel));
+    }
+};
+
+class Data
+{
+public:
+    Data(int value = 0) : value_(value) {}
+    int get_value() const { return value_; }
+    void set_value(int new_value) { value_ = new_value; }
+
+private:
+    int value_;
+};
+
+atomic_rc_ptr<Data> data{make_rc<Data>()};
+
+void writer()
+{
+    for (int i = 0; i < 10; ++i)
+    {
+        data.store(make_rc<Data>(i));
+        std::this_thread::sleep_for(100ms);
+    }
+}
+
+void reader()
+{
+    for (int i = 0; i < 10; ++i)
+    {
+        if (auto p = data.load())
+            std::cout << "读取线程值: " << p->get_value() << std::endl;
+        else
+            std::cout << "没有读取到数据" << std::endl;
+        std::this_thread::sleep_for(100ms);
+    }
+}
+
+// 与 writer/reader 相同的模式扩展到多个读者：1 个写者持续替换指针，N 个读者在固定时间内尽可能多地读取
+template <typename Read, typename Write>
+double reader_benchmark(std::size_t num_readers, std::chrono::milliseconds duration, Read read, Write write)
+{
+    std::atomic_bool stop{false};
+    std::atomic<std::uint64_t> total{0};
+    {
+        std::vector<std::jthread> threads;
+        threads.emplace_back([&]
+                             {
+            for (int i = 0; !stop.load(std::memory_order_relaxed); ++i)
+            {
+                write(i);
+                std::this_thread::sleep_for(10us);
+            } });
+        for (std::size_t r = 0; r < num_readers; ++r)
+        {
+            threads.emplace_back([&]
+                                 {
+                std::uint64_t reads = 0;
+                long long sum = 0;
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    sum += read();
+                    ++reads;
+                }
+                assert(sum >= 0);
+                total += reads; });
+        }
+        std::this_thread::sleep_for(duration);
+        stop = true;
+    }
+    return total / std::chrono::duration<double>(duration).count() / 1e6;
+}
+
+// 压力测试：读者反复把外部计数推过上限，写者同时替换指针（包括重新存入同一个控制块），结束后所有对象都必须恰好被释放一次
+struct tracked
+{
+    static inline std::atomic<long> live{0};
+    int value;
+    explicit tracked(int v) : value(v) { live.fetch_add(1, std::memory_order_relaxed); }
+    ~tracked()
+    {
+        value = -1;
+        live.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
+void saturation_stress(std::size_t num_readers, std::chrono::milliseconds duration)
+{
+    {
+        atomic_rc_ptr<tracked> shared{make_rc<tracked>(0)};
+        std::atomic_bool stop{false};
+        std::atomic_bool bad{false};
+        std::vector<std::jthread> threads;
+        threads.emplace_back([&]
+                             {
+            std::vector<rc_ptr<tracked>> pool;
+            for (int i = 0; i < 4; ++i)
+                pool.push_back(make_rc<tracked>(i));
+            std::mt19937 gen{42};
+            for (int i = 0; !stop.load(std::memory_order_relaxed); ++i)
+            {
+                if (i % 2)
+                    shared.store(pool[gen() % pool.size()]);
+                else
+                    pool[gen() % pool.size()] = shared.exchange(make_rc<tracked>(i));
+                // 不睡眠而是让出时间片：写者始终可运行，才能落在读者清零外部计数的窗口中
+                auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(gen() % 2000);
+                while (std::chrono::steady_clock::now() < until && !stop.load(std::memory_order_relaxed))
+                    std::this_thread::yield();
+            } });
+        for (std::size_t r = 0; r < num_readers; ++r)
+        {
+            threads.emplace_back([&]
+                                 {
+                rc_ptr<tracked> kept;
+                for (std::uint64_t i = 0; !stop.load(std::memory_order_relaxed); ++i)
+                {
+                    rc_ptr<tracked> p = shared.load();
+                    if (!p || p->value < 0)
+                        bad = true;
+                    if (i % 1024 == 0)
+                        kept = p;
+                } });
+        }
+        std::this_thread::sleep_for(duration);
+        stop = true;
+        threads.clear();
+        assert(!bad);
+    }
+    std::cout << "饱和压力测试结束后存活的对象数: " << tracked::live.load() << '\n'; // 0
+    assert(tracked::live.load() == 0);
+}
+
+int main()
+{
+    std::thread t1(writer);
+    std::thread t2(reader);
+    t1.join();
+    t2.join();
+
+    saturation_stress(4, 1s);
+
+    std::atomic<std::shared_ptr<Data>> std_data = std::make_shared<Data>();
+    atomic_rc_ptr<Data> rc_data{make_rc<Data>()};
+    std::cout << std::boolalpha << "std::atomic<std::shared_ptr>::is_lock_free(): " << std_data.is_lock_free()
+              << "\natomic_rc_ptr::is_lock_free(): " << rc_data.is_lock_free() << '\n';
+
+    std::size_t max_readers = std::max(4u, std::thread::hardware_concurrency());
+    std::cout << "读者数\tatomic<shared_ptr>\tatomic_rc_ptr（百万次读/秒）\n";
+    for (std::size_t n = 1; n <= max_readers; n *= 2)
+    {
+        std::cout << n << '\t'
+                  << reader_benchmark(
+                         n, 300ms, [&]
+                         { return std_data.load()->get_value(); },
+                         [&](int i)
+                         { std_data.store(std::make_shared<Data>(i)); })
+                  << '\t'
+                  << reader_benchmark(
+                         n, 300ms, [&]
+                         { return rc_data.load()->get_value(); },
+                         [&](int i)
+                         { rc_data.store(make_rc<Data>(i)); })
+                  << '\n';
+    }
+}
+#elif defined(VERSION_13)
+// 危险指针（hazard pointer）：无锁数据结构的内存回收
+/*
+无锁结构中，一个线程把节点从结构中摘下后不能立即 delete，因为其它线程可能刚刚读到这个指针，正准备解引用
+危险指针：
+1: 读者在解引用之前，把指针写入一个自己独占的、所有线程都能看到的槽（slot），再确认源指针没有变化，此后这个节点不会被回收
+2: 摘下节点的线程不直接 delete，而是把它放进线程自己的待回收列表（retire）
+3: 待回收列表达到阈值（与槽的总数成正比）时扫描一次所有槽，没有被任何槽引用的节点才真正回收，这样每次 retire 的均摊代价是常数
+接口仿照 C++26 的 <hazard_pointer>（P2530）：make_hazard_pointer()、protect()/try_protect()、hazard_pointer_obj_base<T>::retire()
+无锁栈、队列、map 共用同一个 hazard_domain，线程退出时尚未回收的节点转交给 domain，由其它线程的扫描或 domain 的析构回收
+注意：hazard_domain 必须比使用它的线程活得更久（默认的 domain 是函数内的静态对象，满足这一点）
+*/
+
+constexpr std::size_t cache_line_size = 64;
+
+class hazard_pointer;
+
+class hazard_domain
+{
+public:
+    using reclaim_fn = void (*)(void *);
+
+    hazard_domain() = default;
+    hazard_domain(const hazard_domain &) = delete;
+    hazard_domain &operator=(const hazard_domain &) = delete;
+
+    ~hazard_domain()
+    {
+        // 此时已经没有线程持有危险指针，剩下的节点都可以直接回收
+        for (auto &r : orphans_)
+            r.reclaim(r.object);
+        for (slot *s = slots_.load(std::memory_order_relaxed); s;)
+            delete std::exchange(s, s->next);
+    }
+
+    void retire(void *object, reclaim_fn reclaim)
+    {
+        thread_state &state = local();
+        state.retired.push_back({object, reclaim});
+        if (state.retired.size() >= scan_threshold())
+            scan(state);
+    }
+
+    template <typename T, typename D = std::default_delete<T>>
+    void retire(T *object)
+    {
+        retire(object, [](void *p)
+               { D{}(static_cast<T *>(p)); });
+    }
+
+    // 立即扫描一次当前线程的待回收列表以及已退出线程遗留的节点
+    void cleanup()
+    {
+        scan(local());
+    }
+
+private:
+    friend class hazard_pointer;
+
+    struct alignas(cache_line_size) slot
+    {
+        std::atomic<const void *> ptr{nullptr};
+        std::atomic_bool in_use{true};
+        slot *next = nullptr;
+    };
+
+    struct retired_node
+    {
+        void *object;
+        reclaim_fn reclaim;
+    };
+
+    struct thread_state
+    {
+        hazard_domain *domain;
+        std::vector<slot *> free_slots;
+        std::vector<retired_node> retired;
+    };
+
+    // 每个线程在每个 domain 中的状态，线程退出时将其交还给 domain
+    struct thread_registry
+    {
+        std::vector<thread_state> states;
+        ~thread_registry()
+        {
+            for (auto &state : states)
+                state.domain->detach(state);
+        }
+    };
+
+    static constexpr std::size_t max_cached_slots = 8;
+
+    std::atomic<slot *> slots_{nullptr};
+    std::atomic<std::size_t> slot_count_{0};
+    std::mutex orphans_mutex_;
+    std::vector<retired_node> orphans_;
+    std::atomic_bool has_orphans_{false};
+
+    thread_state &local()
+    {
+        thread_local thread_registry registry;
+        for (auto &state : registry.states)
+            if (state.domain == this)
+                return state;
+        return registry.states.emplace_back(thread_state{this, {}, {}});
+    }
+
+    std::size_t scan_threshold() const noexcept
+    {
+        return 2 * slot_count_.load(std::memory_order_relaxed) + 64;
+    }
+
+    slot *acquire_slot()
+    {
+        thread_state &state = local();
+        if (!state.free_slots.empty())
+        {
+            slot *s = state.free_slots.back();
+            state.free_slots.pop_back();
+            return s;
+        }
+        for (slot *s = slots_.load(std::memory_order_acquire); s; s = s->next)
+        {
+            bool expected = false;
+            if (!s->in_use.load(std::memory_order_relaxed) &&
+                s->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                return s;
+        }
+        // 槽只增不减，直到 domain 析构，因此遍历链表的线程不需要额外保护
+        auto *s = new slot;
+        s->next = slots_.load(std::memory_order_relaxed);
+        while (!slots_.compare_exchange_weak(s->next, s, std::memory_order_release, std::memory_order_relaxed))
+            ;
+        slot_count_.fetch_add(1, std::memory_order_relaxed);
+        return s;
+    }
+
+    void release_slot(slot *s)
+    {
+        s->ptr.store(nullptr, std::memory_order_release);
+        thread_state &state = local();
+        if (state.free_slots.size() < max_cached_slots)
+            state.free_slots.push_back(s);
+        else
+            s->in_use.store(false, std::memory_order_release);
+    }
+
+    void scan(thread_state &state)
+    {
+        if (has_orphans_.load(std::memory_order_relaxed) && orphans_mutex_.try_lock())
+        {
+            state.retired.insert(state.retired.end(), orphans_.begin(), orphans_.end());
+            orphans_.clear();
+            has_orphans_.store(false, std::memory_order_relaxed);
+            orphans_mutex_.unlock();
+        }
+
+        // 与 protect() 中写槽之后的 seq_cst 操作配对：要么读者能看到节点已被摘下，要么这里能看到读者的槽
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::vector<const void *> hazards;
+        for (slot *s = slots_.load(std::memory_order_acquire); s; s = s->next)
+            if (const void *p = s->ptr.load(std::memory_order_seq_cst))
+                hazards.push_back(p);
+        std::sort(hazards.begin(), hazards.end());
+
+        auto protected_end = std::partition(state.retired.begin(), state.retired.end(), [&](const retired_node &r)
+                                            { return std::binary_search(hazards.begin(), hazards.end(), r.object); });
+        // 回收函数中可能再次调用 retire，因此先从列表中移出
+        std::vector<retired_node> reclaimable(protected_end, state.retired.end());
+        state.retired.erase(protected_end, state.retired.end());
+        for (auto &r : reclaimable)
+            r.reclaim(r.object);
+    }
+
+    void detach(thread_state &state)
+    {
+        for (slot *s : state.free_slots)
+            s->in_use.store(false, std::memory_order_release);
+        state.free_slots.clear();
+        scan(state);
+        if (!state.retired.empty())
+        {
+            std::lock_guard<std::mutex> lk{orphans_mutex_};
+            orphans_.insert(orphans_.end(), state.retired.begin(), state.retired.end());
+            has_orphans_.store(true, std::memory_order_relaxed);
+        }
+        state.retired.clear();
+    }
+};
+
+inline hazard_domain &default_hazard_domain()
+{
+    static hazard_domain domain;
+    return domain;
+}
+
+class hazard_pointer
+{
+    hazard_domain *domain_ = nullptr;
+    hazard_domain::slot *slot_ = nullptr;
+
+    hazard_pointer(hazard_domain &domain) : domain_(&domain), slot_(domain.acquire_slot()) {}
+    friend hazard_pointer make_hazard_pointer(hazard_domain &domain);
+
+    // 把槽还给所属的域，析构与移动赋值共用
+    void release() noexcept
+    {
+        if (slot_)
+            domain_->release_slot(std::exchange(slot_, nullptr));
+        domain_ = nullptr;
+    }
+
+public:
+    hazard_pointer() noexcept = default;
+    hazard_pointer(hazard_pointer &&other) noexcept
+        : domain_(std::exchange(other.domain_, nullptr)), slot_(std::exchange(other.slot_, nullptr)) {}
+    hazard_pointer &operator=(hazard_pointer &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            domain_ = std::exchange(other.domain_, nullptr);
+            slot_ = std::exchange(other.slot_, nullptr);
+        }
+        return *this;
+    }
+    ~hazard_pointer() { release(); }
+
+    bool empty() const noexcept { return slot_ == nullptr; }
+
+    // 读取 src 并保护读到的指针，返回之后直到 reset_protection() 之前解引用都是安全的
+    template <typename T>
+    T *protect(const std::atomic<T *> &src) noexcept
+    {
+        T *ptr = src.load(std::memory_order_relaxed);
+        while (!try_protect(ptr, src))
+            ;
+        return ptr;
+    }
+
+    // 保护 ptr，若 src 已经不再等于 ptr 则失败，并将 ptr 更新为 src 的当前值
+    template <typename T>
+    bool try_protect(T *&ptr, const std::atomic<T *> &src) noexcept
+    {
+        T *expected = ptr;
+        slot_->ptr.store(expected, std::memory_order_seq_cst);
+        ptr = src.load(std::memory_order_seq_cst);
+        if (ptr == expected)
+            return true;
+        reset_protection();
+        return false;
+    }
+
+    void reset_protection(std::nullptr_t = nullptr) noexcept
+    {
+        slot_->ptr.store(nullptr, std::memory_order_release);
+    }
+};
+
+inline hazard_pointer make_hazard_pointer(hazard_domain &domain = default_hazard_domain())
+{
+    return hazard_pointer(domain);
+}
+
+// 需要被危险指针保护的节点类型继承它，以获得 retire()
+template <typename T, typename D = std::default_delete<T>>
+class hazard_pointer_obj_base
+{
+public:
+    void retire(hazard_domain &domain = default_hazard_domain()) noexcept
+    {
+        domain.retire<T, D>(static_cast<T *>(this));
+    }
+
+protected:
+    hazard_pointer_obj_base() = default;
+};
+
+// 使用危险指针的无锁栈（Treiber stack）
+template <typename T>
+class lock_free_stack
+{
+    struct node : hazard_pointer_obj_base<node>
+    {
+        T value;
+        node *next = nullptr;
+        explicit node(T v) : value(std::move(v)) {}
+    };
+
+    std::atomic<node *> head_{nullptr};
+
+public:
+    lock_free_stack() = default;
+    lock_free_stack(const lock_free_stack &) = delete;
+    lock_free_stack &operator=(const lock_free_stack &) = delete;
+    ~lock_free_stack()
+    {
+        for (node *n = head_.load(std::memory_order_relaxed); n;)
+            delete std::exchange(n, n->next);
+    }
+
+    void push(T value)
+    {
+        auto *n = new node(std::move(value));
+        n->next = head_.load(std::memory_order_relaxed);
+        while (!head_.compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed))
+            ;
+    }
+
+    std::optional<T> pop()
+    {
+        hazard_pointer hp = make_hazard_pointer();
+        node *old;
+        for (;;)
+        {
+            old = hp.protect(head_);
+            if (!old)
+                return std::nullopt;
+            // old 受保护，读取 old->next 是安全的，也不会出现 ABA：old 在被保护期间不会被回收再分配
+            if (head_.compare_exchange_strong(old, old->next, std::memory_order_acquire, std::memory_order_relaxed))
+                break;
+        }
+        hp.reset_protection();
+        std::optional<T> result{std::move(old->value)};
+        old->retire();
+        return result;
+    }
+};
+
+// 压力测试：多个线程随机 push/pop，检查元素不丢不重，且所有节点最终都被回收
+// 可以分别加上 -fsanitize=address 与 -fsanitize=thread 编译运行，检查释放后使用与数据竞争
+struct counted
+{
+    static inline std::atomic<long> live{0};
+    long value;
+    counted(long v) : value(v) { ++live; }
+    counted(const counted &other) : value(other.value) { ++live; }
+    ~counted() { --live; }
+};
+
+void stress_test(std::size_t num_threads, std::size_t ops_per_thread)
+{
+    {
+        lock_free_stack<counted> stack;
+        std::atomic<long long> pushed{0}, popped{0};
+        {
+            std::vector<std::jthread> threads;
+            for (std::size_t t = 0; t < num_threads; ++t)
+            {
+                threads.emplace_back([&, t]
+                                     {
+                    std::uint32_t x = static_cast<std::uint32_t>(t) * 2654435761u + 1;
+                    long long local_pushed = 0, local_popped = 0;
+                    for (std::size_t i = 0; i < ops_per_thread; ++i)
+                    {
+                        x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+                        if (x & 1)
+                        {
+                            stack.push(counted{static_cast<long>(i)});
+                            local_pushed += static_cast<long>(i);
+                        }
+                        else if (auto v = stack.pop())
+                            local_popped += v->value;
+                    }
+                    pushed += local_pushed;
+                    popped += local_popped; });
+            }
+        }
+        while (auto v = stack.pop())
+            popped += v->value;
+        assert(pushed == popped);
+        std::cout << "压力测试: push 总和 " << pushed << ", pop 总和 " << popped << '\n';
+    }
+    default_hazard_domain().cleanup();
+    assert(counted::live == 0);
+    std::cout << "回收后存活节点数: " << counted::live << '\n';
+}
+
+class Data
+{
+public:
+    Data(int value = 0) : value_(value) {}
+    int get_value() const { return value_; }
+
+private:
+    int value_;
+};
+
+// protect() 的开销与复制 std::shared_ptr（对共享的控制块做原子加减）的开销对比
+template <typename Read>
+double read_benchmark(std::size_t num_threads, std::size_t iterations, Read read)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<long long> sink{0};
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t t = 0; t < num_threads; ++t)
+            threads.emplace_back([&]
+                                 { sink += read(iterations); });
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    assert(sink >= 0);
+    return elapsed.count() / iterations;
+}
+
+int main()
+{
+    stress_test(std::max(4u, std::thread::hardware_concurrency()), 200000);
+
+    std::atomic<Data *> raw{new Data(42)};
+    auto shared = std::make_shared<Data>(42);
+    constexpr std::size_t iterations = 2'000'000;
+    std::size_t max_threads = std::max(4u, std::thread::hardware_concurrency());
+    std::cout << "线程数\tprotect()\tshared_ptr 复制（纳秒/次）\n";
+    for (std::size_t n = 1; n <= max_threads; n *= 2)
+    {
+        std::cout << n << '\t'
+                  << read_benchmark(n, iterations, [&](std::size_t count)
+                                    {
+                      hazard_pointer hp = make_hazard_pointer();
+                      long long sum = 0;
+                      for (std::size_t i = 0; i < count; ++i)
+                      {
+                          sum += hp.protect(raw)->get_value();
+                          hp.reset_protection();
+                      }
+                      return sum; })
+                  << '\t'
+                  << read_benchmark(n, iterations, [&](std::size_t count)
+                                    {
+                      long long sum = 0;
+                      for (std::size_t i = 0; i < count; ++i)
+                      {
+                          std::shared_ptr<Data> copy = shared;
+                          sum += copy->get_value();
+                      }
+                      return sum; })
+                  << '\n';
+    }
+    delete raw.load();
+}
+#elif defined(VERSION_14)
+// 基于纪元的回收（epoch-based reclamation, EBR）：读多写少的结构用它代替危险指针
+/*
+危险指针每保护一次读取都要写一次槽并执行一次 seq_cst 屏障；对 Settings、配置对象这类读取极其频繁、很少替换的快照，更希望每个临界区只付出一次代价
+EBR：
+1: 全局有一个纪元计数 global_epoch，读者进入临界区时把当前纪元记录到自己的槽中，离开时清空，临界区内可以读取任意多个指针
+2: 写者摘下对象后调用 retire，对象按当时的纪元放入三个延迟释放列表之一
+3: 只有当所有处于临界区的读者都已经看到当前纪元时，纪元才能推进；推进到 e + 1 时，纪元 e - 2 中退休的对象不可能再被任何读者引用，可以释放
+推进纪元与释放对象都由后台回收线程完成，读者从不等待；代价是一个长时间停留在临界区的读者会推迟所有回收
+（QSBR 要求每个线程周期性地报告静止状态，适合线程池这类自己掌控循环的场景；这里用 EBR，不在临界区内的线程不会阻碍回收）
+注意：epoch_domain 必须比使用它的线程活得更久
+*/
+
+constexpr std::size_t cache_line_size = 64;
+
+class epoch_domain
+{
+public:
+    using reclaim_fn = void (*)(void *);
+
+    explicit epoch_domain(std::chrono::milliseconds period = 1ms)
+        : period_(period), reclaimer_([this](std::stop_token st)
+                                      { reclaim_loop(st); })
+    {
+    }
+    epoch_domain(const epoch_domain &) = delete;
+    epoch_domain &operator=(const epoch_domain &) = delete;
+
+    ~epoch_domain()
+    {
+        reclaimer_.request_stop();
+        reclaimer_.join();
+        // 此时已经没有读者，剩下的对象都可以直接释放
+        for (auto &list : limbo_)
+            for (auto &r : list)
+                r.reclaim(r.object);
+        for (participant *p = participants_.load(std::memory_order_relaxed); p;)
+            delete std::exchange(p, p->next);
+    }
+
+    // 读临界区的 RAII 守卫，可以嵌套
+    class guard
+    {
+        epoch_domain *domain_;
+
+    public:
+        explicit guard(epoch_domain &domain) : domain_(&domain) { domain_->enter(); }
+        guard(const guard &) = delete;
+        guard &operator=(const guard &) = delete;
+        ~guard() { domain_->exit(); }
+    };
+
+    [[nodiscard]] guard read_lock() { return guard(*this); }
+
+    // 对象必须已经从共享结构中摘下，之后进入临界区的读者不可能再读到它
+    void retire(void *object, reclaim_fn reclaim)
+    {
+        std::size_t pending;
+        {
+            std::lock_guard<std::mutex> lk{limbo_mutex_};
+            std::uint64_t epoch = global_epoch_.load(std::memory_order_seq_cst);
+            limbo_[epoch % 3].push_back({object, reclaim});
+            pending = pending_.fetch_add(1, std::memory_order_relaxed) + 1;
+        }
+        if (pending >= wake_threshold)
+            wake_.notify_one();
+    }
+
+    template <typename T, typename D = std::default_delete<T>>
+    void retire(T *object)
+    {
+        retire(const_cast<void *>(static_cast<const void *>(object)), [](void *p)
+               { D{}(static_cast<T *>(p)); });
+    }
+
+    // 尚未释放的对象数
+    std::size_t pending() const noexcept { return pending_.load(std::memory_order_relaxed); }
+    std::uint64_t epoch() const noexcept { return global_epoch_.load(std::memory_order_relaxed); }
+
+    // 推进纪元直到调用之前退休的对象全部释放（调用线程不能处于临界区中）
+    void drain()
+    {
+        for (int advanced = 0; advanced < 3;)
+        {
+            if (try_advance())
+                ++advanced;
+            else
+                std::this_thread::yield();
+        }
+    }
+
+private:
+    static constexpr std::size_t wake_threshold = 1024;
+
+    // 槽的值：0 表示不在临界区，否则为 (纪元 << 1) | 1
+    struct alignas(cache_line_size) participant
+    {
+        std::atomic<std::uint64_t> local{0};
+        std::atomic_bool in_use{true};
+        participant *next = nullptr;
+    };
+
+    struct retired_node
+    {
+        void *object;
+        reclaim_fn reclaim;
+    };
+
+    struct thread_state
+    {
+        epoch_domain *domain;
+        participant *slot;
+        unsigned depth = 0;
+    };
+
+    struct thread_registry
+    {
+        std::vector<thread_state> states;
+        ~thread_registry()
+        {
+            for (auto &state : states)
+            {
+                state.slot->local.store(0, std::memory_order_release);
+                state.slot->in_use.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    std::atomic<std::uint64_t> global_epoch_{1};
+    std::atomic<participant *> participants_{nullptr};
+    std::mutex limbo_mutex_;
+    std::array<std::vector<retired_node>, 3> limbo_;
+    std::atomic<std::size_t> pending_{0};
+
+    std::chrono::milliseconds period_;
+    std::mutex wake_mutex_;
+    std::condition_variable_any wake_;
+    std::jthread reclaimer_;
+
+    thread_state &local()
+    {
+        thread_local thread_registry registry;
+        for (auto &state : registry.states)
+            if (state.domain == this)
+                return state;
+        return registry.states.emplace_back(thread_state{this, acquire_participant()});
+    }
+
+    participant *acquire_participant()
+    {
+        for (participant *p = participants_.load(std::memory_order_acquire); p; p = p->next)
+        {
+            bool expected = false;
+            if (!p->in_use.load(std::memory_order_relaxed) &&
+                p->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                return p;
+        }
+        auto *p = new participant;
+        p->next = participants_.load(std::memory_order_relaxed);
+        while (!participants_.compare_exchange_weak(p->next, p, std::memory_order_release, std::memory_order_relaxed))
+            ;
+        return p;
+    }
+
+    void enter()
+    {
+        thread_state &state = local();
+        if (state.depth++ > 0)
+            return;
+        std::uint64_t epoch = global_epoch_.load(std::memory_order_relaxed);
+        state.slot->local.store((epoch << 1) | 1, std::memory_order_relaxed);
+        // 保证槽的写入先于临界区内对共享指针的读取被推进纪元的线程看到
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void exit()
+    {
+        thread_state &state = local();
+        if (--state.depth == 0)
+            state.slot->local.store(0, std::memory_order_release);
+    }
+
+    bool try_advance()
+    {
+        std::vector<retired_node> reclaimable;
+        {
+            std::lock_guard<std::mutex> lk{limbo_mutex_};
+            std::uint64_t epoch = global_epoch_.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            for (participant *p = participants_.load(std::memory_order_acquire); p; p = p->next)
+            {
+                std::uint64_t local = p->local.load(std::memory_order_acquire);
+                if ((local & 1) && (local >> 1) != epoch)
+                    return false;
+            }
+            global_epoch_.store(epoch + 1, std::memory_order_seq_cst);
+            // 纪元 epoch - 2 中退休的对象与 epoch + 1 共用同一个列表
+            reclaimable.swap(limbo_[(epoch + 1) % 3]);
+        }
+        // 在锁外释放，不阻塞写者的 retire
+        for (auto &r : reclaimable)
+            r.reclaim(r.object);
+        pending_.fetch_sub(reclaimable.size(), std::memory_order_relaxed);
+        return true;
+    }
+
+    void reclaim_loop(std::stop_token st)
+    {
+        while (!st.stop_requested())
+        {
+            {
+                std::unique_lock<std::mutex> lk{wake_mutex_};
+                wake_.wait_for(lk, st, period_, [this]
+                               { return pending() >= wake_threshold; });
+            }
+            if (pending() > 0)
+                try_advance();
+        }
+    }
+};
+
+inline epoch_domain &default_epoch_domain()
+{
+    static epoch_domain domain;
+    return domain;
+}
+
+// 通过原子指针发布的配置对象，读者在一个临界区内可以多次读取
+struct Config
+{
+    std::string name;
+    std::vector<int> limits;
+    int version = 0;
+};
+
+class published_config
+{
+    std::atomic<const Config *> current_;
+
+public:
+    explicit published_config(Config initial) : current_(new Config(std::move(initial))) {}
+    ~published_config() { delete current_.load(); }
+
+    // 在 fn 返回之前 Config 保持有效
+    template <typename Fn>
+    decltype(auto) read(Fn &&fn) const
+    {
+        auto g = default_epoch_domain().read_lock();
+        return std::forward<Fn>(fn)(*current_.load(std::memory_order_acquire));
+    }
+
+    void publish(Config next)
+    {
+        const Config *old = current_.exchange(new Config(std::move(next)), std::memory_order_acq_rel);
+        default_epoch_domain().retire(old);
+    }
+};
+
+class shared_ptr_config
+{
+    std::atomic<std::shared_ptr<const Config>> current_;
+
+public:
+    explicit shared_ptr_config(Config initial) : current_(std::make_shared<const Config>(std::move(initial))) {}
+
+    template <typename Fn>
+    decltype(auto) read(Fn &&fn) const
+    {
+        return std::forward<Fn>(fn)(*current_.load());
+    }
+
+    void publish(Config next) { current_.store(std::make_shared<const Config>(std::move(next))); }
+};
+
+Config make_config(int version)
+{
+    return Config{"config-" + std::to_string(version), std::vector<int>(8, version), version};
+}
+
+// 1 个写者持续发布新配置，N 个读者在固定时间内尽可能多地读取，并检查读到的配置前后一致
+template <typename Storage>
+double reader_benchmark(std::size_t num_readers, std::chrono::milliseconds duration)
+{
+    Storage storage{make_config(0)};
+    std::atomic_bool stop{false};
+    std::atomic<std::uint64_t> total{0};
+    {
+        std::vector<std::jthread> threads;
+        threads.emplace_back([&]
+                             {
+            for (int i = 1; !stop.load(std::memory_order_relaxed); ++i)
+            {
+                storage.publish(make_config(i));
+                std::this_thread::sleep_for(10us);
+            } });
+        for (std::size_t r = 0; r < num_readers; ++r)
+        {
+            threads.emplace_back([&]
+                                 {
+                std::uint64_t reads = 0;
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    bool consistent = storage.read([](const Config &c)
+                                                   { return c.limits.back() == c.version && c.limits.front() == c.version; });
+                    assert(consistent);
+                    reads += consistent;
+                }
+                total += reads; });
+        }
+        std::this_thread::sleep_for(duration);
+        stop = true;
+    }
+    return total / std::chrono::duration<double>(duration).count() / 1e6;
+}
+
+int main()
+{
+    epoch_domain &domain = default_epoch_domain();
+    {
+        published_config config{make_config(0)};
+        for (int i = 1; i <= 5000; ++i)
+            config.publish(make_config(i));
+        std::cout << "发布 5000 次后待释放: " << domain.pending() << ", 纪元: " << domain.epoch() << '\n';
+        std::this_thread::sleep_for(20ms);
+        std::cout << "后台回收 20ms 后待释放: " << domain.pending() << ", 纪元: " << domain.epoch() << '\n';
+        std::cout << config.read([](const Config &c)
+                                 { return c.name; })
+                  << '\n'; // config-5000
+    }
+
+    std::size_t max_readers = std::max(4u, std::thread::hardware_concurrency());
+    std::cout << "读者数\tatomic<shared_ptr>\tEBR（百万次读/秒）\n";
+    for (std::size_t n = 1; n <= max_readers; n *= 2)
+    {
+        std::cout << n << '\t' << reader_benchmark<shared_ptr_config>(n, 300ms)
+                  << '\t' << reader_benchmark<published_config>(n, 300ms) << '\n';
+    }
+    domain.drain();
+    std::cout << "drain() 后待释放: " << domain.pending() << '\n';
+}
 #endif
\ No newline at end of file
@@ -1,21 +1,40 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstdlib>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <exception>
 #include <functional>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <list>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <numeric>
+#include <optional>
+#include <queue>
+#include <random>
+#include <sstream>
 #include <shared_mutex>
+#include <source_location>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <syncstream>
 #include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 using namespace std::chrono_literals;
 
-#define VERSION_13
+#define VERSION_19
 
 #ifdef VERSION_1
 // 条件竞争
@@ -580,4 +599,2058 @@ int main()
     f2();
 }
 
+#elif defined(VERSION_14)
+// 锁竞争分析：哪些互斥量是热点？
+/*
+profiled_mutex<Mutex> 包装任意互斥量（std::mutex、std::shared_mutex、spinlock_mutex...），接口与被包装的类型相同
+按“锁的声明位置”（构造时的 std::source_location）统计：
+1: 获取次数、发生竞争（try_lock 失败，需要等待）的次数
+2: 等待时间与持有时间的直方图（按 2 的幂分桶，单位纳秒）
+程序退出时按总等待时间从高到低输出报告
+编译时加 -DLOCK_PROFILING 开启；未定义时 profiled_mutex 就是被包装的类型本身，没有任何额外开销
+*/
+
+class spinlock_mutex
+{
+    std::atomic_flag flag{};
+
+public:
+    spinlock_mutex() noexcept = default;
+    void lock() noexcept
+    {
+        while (flag.test_and_set(std::memory_order_acquire))
+            ;
+    }
+    bool try_lock() noexcept { return !flag.test_and_set(std::memory_order_acquire); }
+    void unlock() noexcept { flag.clear(std::memory_order_release); }
+};
+
+#ifdef LOCK_PROFILING
+class duration_histogram
+{
+    static constexpr std::size_t bucket_count = 40; // 第 i 个桶：[2^(i-1), 2^i) 纳秒
+    std::array<std::atomic<std::uint64_t>, bucket_count> buckets_{};
+    std::atomic<std::uint64_t> total_ns_{0};
+    std::atomic<std::uint64_t> max_ns_{0};
+
+public:
+    void record(std::chrono::nanoseconds d) noexcept
+    {
+        auto ns = static_cast<std::uint64_t>(d.count());
+        buckets_[std::min<std::size_t>(std::bit_width(ns), bucket_count - 1)].fetch_add(1, std::memory_order_relaxed);
+        total_ns_.fetch_add(ns, std::memory_order_relaxed);
+        for (auto max = max_ns_.load(std::memory_order_relaxed); ns > max && !max_ns_.compare_exchange_weak(max, ns, std::memory_order_relaxed);)
+            ;
+    }
+
+    std::uint64_t total_ns() const noexcept { return total_ns_.load(std::memory_order_relaxed); }
+    std::uint64_t max_ns() const noexcept { return max_ns_.load(std::memory_order_relaxed); }
+
+    // 在百分位所在的桶内按均匀分布线性插值，是一个近似值；不会超过记录到的最大值
+    std::uint64_t percentile_ns(double p) const noexcept
+    {
+        std::uint64_t count = 0;
+        for (auto &bucket : buckets_)
+            count += bucket.load(std::memory_order_relaxed);
+        if (count == 0)
+            return 0;
+        double rank = p * count;
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucket_count; ++i)
+        {
+            std::uint64_t in_bucket = buckets_[i].load(std::memory_order_relaxed);
+            if (in_bucket && seen + in_bucket >= rank)
+            {
+                if (i == 0)
+                    return 0;
+                double lower = static_cast<double>(std::uint64_t{1} << (i - 1));
+                double fraction = std::clamp((rank - seen) / in_bucket, 0.0, 1.0);
+                return std::min(static_cast<std::uint64_t>(lower + fraction * lower), max_ns());
+            }
+            seen += in_bucket;
+        }
+        return max_ns();
+    }
+};
+
+struct lock_site
+{
+    std::source_location loc;
+    std::atomic<std::uint64_t> acquisitions{0};
+    std::atomic<std::uint64_t> contended{0};
+    duration_histogram wait;
+    duration_histogram hold;
+};
+
+class lock_profiler
+{
+    std::mutex m_;
+    std::map<std::tuple<std::string_view, std::uint_least32_t, std::uint_least32_t>, std::unique_ptr<lock_site>> sites_;
+
+    lock_profiler() = default;
+
+public:
+    static lock_profiler &instance()
+    {
+        static lock_profiler profiler;
+        return profiler;
+    }
+
+    // 同一位置声明的多个互斥量（例如某个类的数据成员）汇总到同一个统计项。返回的指针在程序结束前一直有效
+    lock_site *site(const std::source_location &loc)
+    {
+        std::lock_guard<std::mutex> lk{m_};
+        auto &site = sites_[{loc.file_name(), loc.line(), loc.column()}];
+        if (!site)
+        {
+            site = std::make_unique<lock_site>();
+            site->loc = loc;
+        }
+        return site.get();
+    }
+
+    void report(std::ostream &os)
+    {
+        std::lock_guard<std::mutex> lk{m_};
+        std::vector<lock_site *> sorted;
+        for (auto &[key, site] : sites_)
+            sorted.push_back(site.get());
+        std::sort(sorted.begin(), sorted.end(), [](lock_site *a, lock_site *b)
+                  { return a->wait.total_ns() > b->wait.total_ns(); });
+
+        os << "---------- 锁竞争报告（按总等待时间排序） ----------\n";
+        for (lock_site *s : sorted)
+        {
+            os << s->loc.file_name() << ':' << s->loc.line() << ' ' << s->loc.function_name() << '\n'
+               << "  获取 " << s->acquisitions << " 次，竞争 " << s->contended << " 次\n"
+               << "  等待: 总计 " << s->wait.total_ns() / 1000 << "us  p50 " << s->wait.percentile_ns(0.5)
+               << "ns  p99 " << s->wait.percentile_ns(0.99) << "ns  max " << s->wait.max_ns() << "ns\n"
+               << "  持有: 总计 " << s->hold.total_ns() / 1000 << "us  p50 " << s->hold.percentile_ns(0.5)
+               << "ns  p99 " << s->hold.percentile_ns(0.99) << "ns  max " << s->hold.max_ns() << "ns\n";
+        }
+    }
+
+    // 静态对象在程序退出时析构，此时输出报告
+    ~lock_profiler() { report(std::cerr); }
+};
+
+template <typename Mutex>
+class profiled_mutex
+{
+    using clock = std::chrono::steady_clock;
+
+    Mutex m_;
+    lock_site *site_;
+    clock::time_point acquired_at_{}; // 只由独占持有者读写
+
+    // 共享持有者可能有多个，各自的获取时间记录在线程局部的表中
+    static std::vector<std::pair<const profiled_mutex *, clock::time_point>> &shared_holds()
+    {
+        thread_local std::vector<std::pair<const profiled_mutex *, clock::time_point>> holds;
+        return holds;
+    }
+
+    void acquired(bool contended, clock::time_point wait_start)
+    {
+        auto now = clock::now();
+        site_->acquisitions.fetch_add(1, std::memory_order_relaxed);
+        if (contended)
+            site_->contended.fetch_add(1, std::memory_order_relaxed);
+        site_->wait.record(now - wait_start);
+        acquired_at_ = now;
+    }
+
+public:
+    explicit profiled_mutex(std::source_location loc = std::source_location::current())
+        : site_{lock_profiler::instance().site(loc)} {}
+    profiled_mutex(const profiled_mutex &) = delete;
+    profiled_mutex &operator=(const profiled_mutex &) = delete;
+
+    // 先 try_lock，失败才算一次竞争，再阻塞等待
+    void lock()
+    {
+        auto start = clock::now();
+        bool contended = !m_.try_lock();
+        if (contended)
+            m_.lock();
+        acquired(contended, start);
+    }
+
+    bool try_lock()
+    {
+        auto start = clock::now();
+        if (!m_.try_lock())
+            return false;
+        acquired(false, start);
+        return true;
+    }
+
+    void unlock()
+    {
+        site_->hold.record(clock::now() - acquired_at_);
+        m_.unlock();
+    }
+
+    void lock_shared()
+        requires requires(Mutex &m) { m.lock_shared(); }
+    {
+        auto start = clock::now();
+        bool contended = !m_.try_lock_shared();
+        if (contended)
+            m_.lock_shared();
+        auto now = clock::now();
+        site_->acquisitions.fetch_add(1, std::memory_order_relaxed);
+        if (contended)
+            site_->contended.fetch_add(1, std::memory_order_relaxed);
+        site_->wait.record(now - start);
+        shared_holds().emplace_back(this, now);
+    }
+
+    bool try_lock_shared()
+        requires requires(Mutex &m) { m.try_lock_shared(); }
+    {
+        if (!m_.try_lock_shared())
+            return false;
+        site_->acquisitions.fetch_add(1, std::memory_order_relaxed);
+        shared_holds().emplace_back(this, clock::now());
+        return true;
+    }
+
+    void unlock_shared()
+        requires requires(Mutex &m) { m.unlock_shared(); }
+    {
+        auto &holds = shared_holds();
+        auto it = std::find_if(holds.rbegin(), holds.rend(), [this](auto &h)
+                               { return h.first == this; });
+        site_->hold.record(clock::now() - it->second);
+        holds.erase(std::next(it).base());
+        m_.unlock_shared();
+    }
+};
+#else
+// 关闭分析时直接继承被包装的类型，构造函数的 source_location 形参也在编译期求值，没有运行时开销
+template <typename Mutex>
+class profiled_mutex : public Mutex
+{
+public:
+    explicit profiled_mutex(std::source_location = std::source_location::current()) noexcept {}
+};
+#endif
+
+profiled_mutex<std::mutex> hot_mutex;
+profiled_mutex<spinlock_mutex> cold_mutex;
+
+class Settings
+{
+    std::map<std::string, std::string> data_;
+    mutable profiled_mutex<std::shared_mutex> mutex_;
+
+public:
+    void set(const std::string &key, const std::string &value)
+    {
+        std::lock_guard lock{mutex_};
+        data_[key] = value;
+    }
+
+    std::string get(const std::string &key) const
+    {
+        std::shared_lock lock{mutex_};
+        auto it = data_.find(key);
+        return (it != data_.end()) ? it->second : "";
+    }
+};
+
+int main()
+{
+    std::size_t counter = 0;
+    Settings settings;
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < 4; ++i)
+        {
+            threads.emplace_back([&, i]
+                                 {
+                for (int j = 0; j < 20'000; ++j)
+                {
+                    {
+                        std::lock_guard lk{hot_mutex};
+                        ++counter; // 所有线程都在抢同一个锁
+                    }
+                    if (j % 1000 == 0)
+                    {
+                        std::lock_guard lk{cold_mutex};
+                        ++counter;
+                    }
+                    if (j % 10 == 0)
+                        settings.set("key" + std::to_string(i), std::to_string(j));
+                    else
+                        settings.get("key" + std::to_string((i + 1) % 4));
+                } });
+        }
+    }
+    std::cout << counter << '\n';
+} // lock_profiler 在退出时输出报告
+
+#elif defined(VERSION_15)
+// 读多写少：VERSION_9 的 Settings 使用 std::shared_mutex
+/*
+1: 即使只有读者，每次 shared_lock 也要对 shared_mutex 内部的读者计数做原子读-改-写，所有读者在同一个缓存行上互相争抢
+2: get 返回 std::string 的副本
+改用 RCU（read-copy-update）风格的快照：
+1: 数据保存在不可变的 map 快照中，通过原子指针发布
+2: 读者不加锁，也没有任何原子读-改-写：只在自己独占的缓存行（reader_slot）上写入“正在读”，然后读取当前快照
+3: 写者复制当前快照、修改、发布新快照，然后等待宽限期（所有在发布前进入的读者都离开），再释放旧快照
+4: 写者可以把多次修改合并到一次 update 中，只生成一个新快照
+*/
+
+// 避免伪共享
+constexpr std::size_t cache_line_size = 64;
+
+// 所有 rcu 读者的登记表。序号为奇数表示该线程正处于读临界区中
+class rcu_domain
+{
+    struct alignas(cache_line_size) reader_slot
+    {
+        std::atomic<std::uint64_t> seq{0};
+        std::atomic_bool in_use{false};
+    };
+
+    std::mutex m_;
+    std::list<reader_slot> slots_; // std::list 的节点地址稳定，线程可以一直持有自己的槽位
+
+    // 线程退出时归还槽位，之后的新线程可以复用
+    struct thread_slot
+    {
+        reader_slot *slot = nullptr;
+        unsigned depth = 0; // 同一线程嵌套的读临界区只在最外层登记
+        ~thread_slot()
+        {
+            if (slot)
+                slot->in_use.store(false, std::memory_order_release);
+        }
+    };
+
+    thread_slot &local()
+    {
+        thread_local thread_slot local;
+        if (!local.slot)
+        {
+            std::lock_guard<std::mutex> lk{m_};
+            for (auto &slot : slots_)
+            {
+                if (!slot.in_use.load(std::memory_order_acquire))
+                {
+                    local.slot = &slot;
+                    break;
+                }
+            }
+            if (!local.slot)
+                local.slot = &slots_.emplace_back();
+            local.slot->in_use.store(true, std::memory_order_relaxed);
+        }
+        return local;
+    }
+
+public:
+    static rcu_domain &instance()
+    {
+        static rcu_domain domain;
+        return domain;
+    }
+
+    void read_lock()
+    {
+        auto &l = local();
+        if (l.depth++ == 0)
+        {
+            auto seq = l.slot->seq.load(std::memory_order_relaxed);
+            l.slot->seq.store(seq + 1, std::memory_order_relaxed);
+            // 与 synchronize 中的栅栏配对：要么写者看到本线程正在读，要么本线程读到写者发布的新快照
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    void read_unlock()
+    {
+        auto &l = local();
+        if (--l.depth == 0)
+            l.slot->seq.store(l.slot->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // 等待宽限期：调用时正处于读临界区中的线程都离开之后才返回
+    void synchronize()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::lock_guard<std::mutex> lk{m_};
+        for (auto &slot : slots_)
+        {
+            auto seq = slot.seq.load(std::memory_order_acquire);
+            if (seq & 1)
+            {
+                while (slot.seq.load(std::memory_order_acquire) == seq)
+                    std::this_thread::yield();
+            }
+        }
+    }
+};
+
+class Settings
+{
+public:
+    using map_type = std::map<std::string, std::string>;
+
+    // 读临界区的 RAII 守卫，持有期间快照不会被释放。不要长时间持有，写者需要等待它
+    class snapshot
+    {
+        const map_type *map_;
+
+    public:
+        explicit snapshot(const std::atomic<const map_type *> &current)
+        {
+            rcu_domain::instance().read_lock();
+            map_ = current.load(std::memory_order_acquire);
+        }
+        ~snapshot() { rcu_domain::instance().read_unlock(); }
+        snapshot(const snapshot &) = delete;
+        snapshot &operator=(const snapshot &) = delete;
+
+        const map_type &operator*() const noexcept { return *map_; }
+        const map_type *operator->() const noexcept { return map_; }
+    };
+
+private:
+    std::atomic<const map_type *> current_{new map_type{}};
+    std::mutex write_mutex_; // 只在写者之间互斥
+
+    void publish(const map_type *next)
+    {
+        const map_type *old = current_.exchange(next, std::memory_order_acq_rel);
+        rcu_domain::instance().synchronize();
+        delete old;
+    }
+
+public:
+    Settings() = default;
+    Settings(const Settings &) = delete;
+    Settings &operator=(const Settings &) = delete;
+    ~Settings() { delete current_.load(std::memory_order_relaxed); }
+
+    snapshot read() const { return snapshot{current_}; }
+
+    // 批量修改：fn 在当前快照的副本上修改，最后只发布一次
+    template <typename F>
+    void update(F fn)
+    {
+        std::lock_guard<std::mutex> lk{write_mutex_};
+        auto next = std::make_unique<map_type>(*current_.load(std::memory_order_relaxed));
+        fn(*next);
+        publish(next.release());
+    }
+
+    void set(const std::string &key, const std::string &value)
+    {
+        update([&](map_type &map)
+               { map[key] = value; });
+    }
+
+    // 在读临界区中调用 fn(const std::string &)，避免复制字符串；没有找到键返回 false
+    template <typename F>
+    bool visit(const std::string &key, F fn) const
+    {
+        auto snap = read();
+        auto it = snap->find(key);
+        if (it == snap->end())
+            return false;
+        fn(it->second);
+        return true;
+    }
+
+    std::string get(const std::string &key) const
+    {
+        std::string value;
+        visit(key, [&](const std::string &v)
+              { value = v; });
+        return value;
+    }
+};
+
+// 对比对象一：VERSION_9 的读写锁版本
+class Settings_shared_mutex
+{
+    std::map<std::string, std::string> data_;
+    mutable std::shared_mutex mutex_;
+
+public:
+    void set(const std::string &key, const std::string &value)
+    {
+        std::lock_guard<std::shared_mutex> lock{mutex_};
+        data_[key] = value;
+    }
+
+    template <typename F>
+    bool visit(const std::string &key, F fn) const
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = data_.find(key);
+        if (it == data_.end())
+            return false;
+        fn(it->second);
+        return true;
+    }
+};
+
+// 对比对象二：std::atomic<std::shared_ptr<const map>> 发布快照，每次 load 都要对引用计数做原子读-改-写
+class Settings_atomic_shared_ptr
+{
+    using map_type = std::map<std::string, std::string>;
+    std::atomic<std::shared_ptr<const map_type>> current_{std::make_shared<const map_type>()};
+    std::mutex write_mutex_;
+
+public:
+    void set(const std::string &key, const std::string &value)
+    {
+        std::lock_guard<std::mutex> lk{write_mutex_};
+        auto next = std::make_shared<map_type>(*current_.load());
+        (*next)[key] = value;
+        current_.store(std::move(next));
+    }
+
+    template <typename F>
+    bool visit(const std::string &key, F fn) const
+    {
+        auto snap = current_.load();
+        auto it = snap->find(key);
+        if (it == snap->end())
+            return false;
+        fn(it->second);
+        return true;
+    }
+};
+
+// 1 个写者每 100us 修改一次，N 个读者在固定时间内尽可能多地读取，返回读者的总吞吐（百万次/秒）
+template <typename S>
+double read_benchmark(std::size_t num_readers, std::chrono::milliseconds duration)
+{
+    S settings;
+    for (int i = 0; i < 64; ++i)
+        settings.set("key" + std::to_string(i), "value" + std::to_string(i));
+
+    std::atomic_bool stop{false};
+    std::atomic<std::uint64_t> total{0};
+    {
+        std::vector<std::jthread> threads;
+        threads.emplace_back([&]
+                             {
+            for (int i = 0; !stop.load(std::memory_order_relaxed); ++i)
+            {
+                settings.set("key" + std::to_string(i % 64), "value" + std::to_string(i));
+                std::this_thread::sleep_for(100us);
+            } });
+        for (std::size_t r = 0; r < num_readers; ++r)
+        {
+            threads.emplace_back([&, r]
+                                 {
+                std::string key = "key" + std::to_string(r % 64);
+                std::uint64_t reads = 0;
+                std::size_t length = 0;
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    settings.visit(key, [&](const std::string &v)
+                                   { length += v.size(); });
+                    ++reads;
+                }
+                total += reads; });
+        }
+        std::this_thread::sleep_for(duration);
+        stop = true;
+    }
+    return total / std::chrono::duration<double>(duration).count() / 1e6;
+}
+
+int main()
+{
+    Settings settings;
+    settings.update([](Settings::map_type &map)
+                    {
+        map["host"] = "localhost";
+        map["port"] = "8080"; }); // 一次发布两项修改
+    std::cout << settings.get("host") << ':' << settings.get("port") << '\n';
+    {
+        auto snap = settings.read(); // 同一快照中读取多个键，保证彼此一致
+        std::cout << snap->size() << '\n';
+    }
+
+    std::size_t max_readers = std::max(4u, std::thread::hardware_concurrency());
+    std::cout << "读者数\tshared_mutex\tatomic<shared_ptr>\trcu（百万次读/秒）\n";
+    for (std::size_t n = 1; n <= max_readers; n *= 2)
+    {
+        std::cout << n << '\t' << read_benchmark<Settings_shared_mutex>(n, 300ms)
+                  << '\t' << read_benchmark<Settings_atomic_shared_ptr>(n, 300ms)
+                  << '\t' << read_benchmark<Settings>(n, 300ms) << '\n';
+    }
+}
+
+#elif defined(VERSION_16)
+// 写多的键值状态：Settings 用一把锁保护整个有序的 std::map，所有写者串行，读者也要等写者
+/*
+concurrent_hash_map：锁分段（lock striping）
+1: 键按哈希值的高位分到若干分段（shard），每个分段有自己的读写锁和哈希表，不同分段上的操作互不影响
+2: 每个分段是链式哈希表，桶数为 2 的幂，按哈希值的低位选桶
+3: 渐进式扩容：负载过高时只分配一个两倍大小的新桶数组，旧桶中的节点由之后的每次写操作顺带迁移几个桶
+   查找时新表找不到，再去旧表中尚未迁移的桶里找。这样不会有某一次插入需要一口气重新散列整张表
+4: 节点在迁移时只是重新链接，不会重新分配，也不会移动键值
+*/
+
+constexpr std::size_t cache_line_size = 64;
+
+template <typename Key, typename T, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class concurrent_hash_map
+{
+    struct node
+    {
+        std::pair<const Key, T> value;
+        std::size_t hash;
+        node *next;
+    };
+
+    static constexpr std::size_t initial_buckets = 16;
+    static constexpr std::size_t max_load_factor = 1;
+    static constexpr std::size_t migrate_per_write = 8; // 每次写操作最多迁移的旧桶数
+
+    struct alignas(cache_line_size) shard
+    {
+        mutable std::shared_mutex m;
+        std::vector<node *> buckets = std::vector<node *>(initial_buckets);
+        std::vector<node *> old_buckets; // 非空表示正在扩容
+        std::size_t migrated = 0;        // 旧表中已迁移的桶数
+        std::size_t size = 0;
+    };
+
+    std::vector<shard> shards_;
+    unsigned shard_shift_;
+    Hash hasher_;
+    KeyEqual equal_;
+
+    // std::hash 对整数通常是恒等映射。分段取高位、桶取低位，两端都必须充分混合：
+    // 只乘一个常数时低位的 0 会原样保留，步长为 2 的幂的键全部落进同一个桶，这里用 MurmurHash3 的 fmix64 终结函数
+    std::size_t hash(const Key &key) const
+    {
+        std::uint64_t h = hasher_(key);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return static_cast<std::size_t>(h);
+    }
+
+    shard &shard_for(std::size_t h) const { return const_cast<shard &>(shards_[h >> shard_shift_]); }
+
+    node *find_in(const std::vector<node *> &buckets, std::size_t h, const Key &key) const
+    {
+        for (node *n = buckets[h & (buckets.size() - 1)]; n; n = n->next)
+        {
+            if (n->hash == h && equal_(n->value.first, key))
+                return n;
+        }
+        return nullptr;
+    }
+
+    node *find_node(const shard &s, std::size_t h, const Key &key) const
+    {
+        if (node *n = find_in(s.buckets, h, key))
+            return n;
+        if (!s.old_buckets.empty() && (h & (s.old_buckets.size() - 1)) >= s.migrated)
+            return find_in(s.old_buckets, h, key);
+        return nullptr;
+    }
+
+    static void link(std::vector<node *> &buckets, node *n)
+    {
+        node *&head = buckets[n->hash & (buckets.size() - 1)];
+        n->next = head;
+        head = n;
+    }
+
+    // 以下函数要求调用方持有分段的独占锁
+    static void migrate(shard &s, std::size_t count)
+    {
+        for (; count && s.migrated < s.old_buckets.size(); --count, ++s.migrated)
+        {
+            for (node *n = std::exchange(s.old_buckets[s.migrated], nullptr); n;)
+                link(s.buckets, std::exchange(n, n->next));
+        }
+        if (!s.old_buckets.empty() && s.migrated == s.old_buckets.size())
+        {
+            s.old_buckets = {};
+            s.migrated = 0;
+        }
+    }
+
+    static void grow_if_needed(shard &s)
+    {
+        if (s.size <= s.buckets.size() * max_load_factor)
+            return;
+        if (!s.old_buckets.empty()) // 上一次扩容还没迁移完（通常不会发生），先迁移完
+            migrate(s, s.old_buckets.size());
+        s.old_buckets = std::exchange(s.buckets, std::vector<node *>(s.buckets.size() * 2));
+        s.migrated = 0;
+    }
+
+    template <typename K, typename... Args>
+    static node *emplace(shard &s, std::size_t h, K &&key, Args &&...args)
+    {
+        node *n = new node{{std::piecewise_construct, std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...)}, h, nullptr};
+        link(s.buckets, n);
+        ++s.size;
+        grow_if_needed(s);
+        return n;
+    }
+
+    static void clear(std::vector<node *> &buckets)
+    {
+        for (node *&head : buckets)
+        {
+            for (node *n = std::exchange(head, nullptr); n;)
+                delete std::exchange(n, n->next);
+        }
+    }
+
+public:
+    // 分段数取 2 的幂，默认约为硬件线程数的 4 倍。至少两个分段，否则 shard_shift_ 为 64，移位是未定义行为
+    explicit concurrent_hash_map(std::size_t num_shards = std::max(4u, std::thread::hardware_concurrency()) * 4)
+        : shards_(std::bit_ceil(std::max<std::size_t>(2, num_shards))),
+          shard_shift_{static_cast<unsigned>(64 - std::countr_zero(shards_.size()))}
+    {
+        static_assert(sizeof(std::size_t) == 8, "哈希值按 64 位划分分段");
+    }
+    concurrent_hash_map(const concurrent_hash_map &) = delete;
+    concurrent_hash_map &operator=(const concurrent_hash_map &) = delete;
+    ~concurrent_hash_map()
+    {
+        for (auto &s : shards_)
+        {
+            clear(s.buckets);
+            clear(s.old_buckets);
+        }
+    }
+
+    // 返回值的副本：不能把受保护数据的引用带出锁的作用域
+    std::optional<T> find(const Key &key) const
+    {
+        std::size_t h = hash(key);
+        shard &s = shard_for(h);
+        std::shared_lock<std::shared_mutex> lk{s.m};
+        if (node *n = find_node(s, h, key))
+            return n->value.second;
+        return std::nullopt;
+    }
+
+    bool contains(const Key &key) const { return find(key).has_value(); }
+
+    // 插入返回 true，键已存在则赋值并返回 false
+    template <typename V>
+    bool insert_or_assign(const Key &key, V &&value)
+    {
+        std::size_t h = hash(key);
+        shard &s = shard_for(h);
+        std::lock_guard<std::shared_mutex> lk{s.m};
+        migrate(s, migrate_per_write);
+        if (node *n = find_node(s, h, key))
+        {
+            n->value.second = std::forward<V>(value);
+            return false;
+        }
+        emplace(s, h, key, std::forward<V>(value));
+        return true;
+    }
+
+    bool erase(const Key &key)
+    {
+        std::size_t h = hash(key);
+        shard &s = shard_for(h);
+        std::lock_guard<std::shared_mutex> lk{s.m};
+        migrate(s, migrate_per_write);
+        auto erase_in = [&](std::vector<node *> &buckets)
+        {
+            for (node **link = &buckets[h & (buckets.size() - 1)]; *link; link = &(*link)->next)
+            {
+                if ((*link)->hash == h && equal_((*link)->value.first, key))
+                {
+                    delete std::exchange(*link, (*link)->next);
+                    --s.size;
+                    return true;
+                }
+            }
+            return false;
+        };
+        return erase_in(s.buckets) ||
+               (!s.old_buckets.empty() && (h & (s.old_buckets.size() - 1)) >= s.migrated && erase_in(s.old_buckets));
+    }
+
+    // 在锁内原地修改值：键不存在时先插入 T{}。返回是否新插入
+    // fn 在持有分段独占锁时调用，不要在 fn 中访问同一个 concurrent_hash_map
+    template <typename F>
+    bool update(const Key &key, F fn)
+    {
+        std::size_t h = hash(key);
+        shard &s = shard_for(h);
+        std::lock_guard<std::shared_mutex> lk{s.m};
+        migrate(s, migrate_per_write);
+        if (node *n = find_node(s, h, key))
+        {
+            fn(n->value.second);
+            return false;
+        }
+        fn(emplace(s, h, key)->value.second);
+        return true;
+    }
+
+    // 逐个分段遍历，每个分段在共享锁下遍历，因此单个分段内看到的是一致的状态；不同分段之间不保证是同一时刻
+    template <typename F>
+    void for_each(F fn) const
+    {
+        for (auto &s : shards_)
+        {
+            std::shared_lock<std::shared_mutex> lk{s.m};
+            for (auto *buckets : {&s.buckets, &s.old_buckets})
+            {
+                for (node *head : *buckets)
+                {
+                    for (node *n = head; n; n = n->next)
+                        fn(std::as_const(n->value));
+                }
+            }
+        }
+    }
+
+    std::size_t size() const
+    {
+        std::size_t total = 0;
+        for (auto &s : shards_)
+        {
+            std::shared_lock<std::shared_mutex> lk{s.m};
+            total += s.size;
+        }
+        return total;
+    }
+};
+
+// 对比对象：一把读写锁保护的 std::unordered_map
+template <typename Key, typename T>
+class locked_map
+{
+    std::unordered_map<Key, T> map_;
+    mutable std::shared_mutex m_;
+
+public:
+    std::optional<T> find(const Key &key) const
+    {
+        std::shared_lock<std::shared_mutex> lk{m_};
+        auto it = map_.find(key);
+        return it == map_.end() ? std::nullopt : std::optional<T>{it->second};
+    }
+    template <typename V>
+    bool insert_or_assign(const Key &key, V &&value)
+    {
+        std::lock_guard<std::shared_mutex> lk{m_};
+        return map_.insert_or_assign(key, std::forward<V>(value)).second;
+    }
+    template <typename F>
+    bool update(const Key &key, F fn)
+    {
+        std::lock_guard<std::shared_mutex> lk{m_};
+        auto [it, inserted] = map_.try_emplace(key);
+        fn(it->second);
+        return inserted;
+    }
+};
+
+// 每个线程执行 50% update、25% insert_or_assign、25% find
+template <typename Map>
+double mixed_benchmark(std::size_t num_threads, std::size_t ops)
+{
+    Map map;
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t t = 0; t < num_threads; ++t)
+            threads.emplace_back([&, t]
+                                 {
+                std::mt19937_64 gen{t};
+                for (std::size_t i = 0; i < ops; ++i)
+                {
+                    std::uint64_t key = gen() % 100'000;
+                    switch (i % 4)
+                    {
+                    case 0:
+                    case 1:
+                        map.update(key, [](std::uint64_t &v) { ++v; });
+                        break;
+                    case 2:
+                        map.insert_or_assign(key, i);
+                        break;
+                    default:
+                        map.find(key);
+                    }
+                } });
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return num_threads * ops / elapsed.count() / 1e6;
+}
+
+// 单线程连续插入，记录单次插入的最大耗时
+template <typename Map>
+std::chrono::microseconds max_insert_latency(std::size_t count)
+{
+    Map map;
+    std::chrono::steady_clock::duration worst{};
+    for (std::uint64_t i = 0; i < count; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        map.insert_or_assign(i, i);
+        worst = std::max(worst, std::chrono::steady_clock::now() - start);
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(worst);
+}
+
+int main()
+{
+    concurrent_hash_map<std::string, int> word_count;
+    {
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < 4; ++t)
+            threads.emplace_back([&]
+                                 {
+                for (int i = 0; i < 10'000; ++i)
+                    word_count.update("word" + std::to_string(i % 100), [](int &n) { ++n; }); });
+    }
+    std::cout << word_count.size() << ' ' << *word_count.find("word42") << '\n'; // 100 400
+    word_count.erase("word42");
+    std::cout << std::boolalpha << word_count.contains("word42") << '\n'; // false
+    int total = 0;
+    word_count.for_each([&](const auto &kv)
+                        { total += kv.second; });
+    std::cout << total << '\n'; // 39600
+
+    std::size_t max_threads = std::max(4u, std::thread::hardware_concurrency());
+    std::cout << "线程数\tlocked_map\tconcurrent_hash_map（百万次操作/秒）\n";
+    for (std::size_t n = 1; n <= max_threads; n *= 2)
+    {
+        std::cout << n << '\t' << mixed_benchmark<locked_map<std::uint64_t, std::uint64_t>>(n, 500'000)
+                  << '\t' << mixed_benchmark<concurrent_hash_map<std::uint64_t, std::uint64_t>>(n, 500'000) << '\n';
+    }
+
+    std::cout << "插入 4M 个键的最大单次耗时: locked_map " << max_insert_latency<locked_map<std::uint64_t, std::uint64_t>>(4'000'000).count()
+              << "us\tconcurrent_hash_map " << max_insert_latency<concurrent_hash_map<std::uint64_t, std::uint64_t>>(4'000'000).count() << "us\n";
+}
+
+#elif defined(VERSION_17)
+// synchronized<T, Mutex>：数据与互斥量绑定在一起，只能在持锁的作用域内访问
+/*
+VERSION_4 的 Data_wrapper::process_data 只有独占锁，且 func 拿到的引用可以被带出作用域
+synchronized<T, Mutex>：
+1: with_read(fn)  以共享锁调用 fn(const T&)；Mutex 不支持共享锁（std::mutex、自旋锁、hybrid_mutex）时退化为独占锁
+2: with_write(fn) 以独占锁调用 fn(T&)
+3: with_upgrade(fn) 先以共享锁读取，需要修改时调用 upgrade() 换成独占锁，中间不会有其它写者插入
+   可升级的作用域之间互斥（同一时刻只有一个 with_upgrade 在执行，与 with_read 仍可并发），只适合“读完很可能要写”的场景；
+   多数调用不需要写时，应先用 with_read 探测，确实需要修改时再进入 with_upgrade
+4: with_locked(a, b, ..., fn) 以无死锁的方式（std::scoped_lock）同时锁住多个对象
+fn 的返回值按值返回（auto 推导会去掉引用），引用不会通过返回值泄漏；通过捕获把引用带出去仍然无法阻止，这一点与 VERSION_4 一样需要自觉
+升级：std::shared_mutex 不支持原子地从共享锁升级为独占锁。这里让写者与升级者先获取一个额外的 upgrade 互斥量，读者则不需要，
+因此升级者在释放共享锁、获取独占锁的间隙里不会有写者插入，代价是 Mutex 为共享锁时每次写多锁一个 std::mutex
+*/
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+inline void cpu_relax() noexcept { _mm_pause(); }
+#elif defined(__aarch64__)
+inline void cpu_relax() noexcept { asm volatile("yield"); }
+#else
+inline void cpu_relax() noexcept {}
+#endif
+
+class spinlock_mutex
+{
+    std::atomic_flag flag{};
+
+public:
+    spinlock_mutex() noexcept = default;
+    void lock() noexcept
+    {
+        while (!try_lock())
+            while (flag.test(std::memory_order_relaxed))
+                cpu_relax();
+    }
+    bool try_lock() noexcept { return !flag.test_and_set(std::memory_order_acquire); }
+    void unlock() noexcept { flag.clear(std::memory_order_release); }
+};
+
+// 与 atomic_operation.cpp VERSION_10 相同的三态混合锁：先自旋，等不到再在 atomic::wait 上睡眠
+class hybrid_mutex
+{
+    enum : std::uint32_t
+    {
+        unlocked,
+        locked,
+        contended
+    };
+    static constexpr std::uint32_t min_spin = 16;
+    static constexpr std::uint32_t max_spin = 4096;
+
+    std::atomic<std::uint32_t> state_{unlocked};
+    std::atomic<std::uint32_t> spin_budget_{100};
+
+    void adapt(std::uint32_t observed) noexcept
+    {
+        std::uint32_t budget = spin_budget_.load(std::memory_order_relaxed);
+        std::uint32_t target = observed == max_spin ? budget / 2 : observed * 2;
+        budget = static_cast<std::uint32_t>(budget + (static_cast<std::int64_t>(target) - budget) / 8);
+        spin_budget_.store(std::clamp(budget, min_spin, max_spin), std::memory_order_relaxed);
+    }
+
+public:
+    hybrid_mutex() noexcept = default;
+    hybrid_mutex(const hybrid_mutex &) = delete;
+    hybrid_mutex &operator=(const hybrid_mutex &) = delete;
+
+    void lock() noexcept
+    {
+        std::uint32_t c = unlocked;
+        if (state_.compare_exchange_strong(c, locked, std::memory_order_acquire, std::memory_order_relaxed))
+            return;
+        const std::uint32_t budget = spin_budget_.load(std::memory_order_relaxed);
+        for (std::uint32_t i = 0; i < budget; ++i)
+        {
+            cpu_relax();
+            c = state_.load(std::memory_order_relaxed);
+            if (c == unlocked && state_.compare_exchange_weak(c, locked, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                adapt(i + 1);
+                return;
+            }
+        }
+        adapt(max_spin);
+        if (c != contended)
+            c = state_.exchange(contended, std::memory_order_acquire);
+        while (c != unlocked)
+        {
+            state_.wait(contended, std::memory_order_relaxed);
+            c = state_.exchange(contended, std::memory_order_acquire);
+        }
+    }
+
+    bool try_lock() noexcept
+    {
+        std::uint32_t c = unlocked;
+        return state_.compare_exchange_strong(c, locked, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void unlock() noexcept
+    {
+        if (state_.exchange(unlocked, std::memory_order_release) == contended)
+            state_.notify_one();
+    }
+};
+
+template <typename M>
+concept shared_lockable = requires(M m) {
+    m.lock_shared();
+    m.try_lock_shared();
+    m.unlock_shared();
+};
+
+struct synchronized_access;
+
+template <typename T, typename Mutex = std::shared_mutex>
+class synchronized
+{
+    static constexpr bool is_shared = shared_lockable<Mutex>;
+
+    T data_;
+    mutable Mutex m_;
+    mutable std::mutex upgrade_m_; // 仅在 is_shared 时使用
+
+    friend struct synchronized_access;
+
+    void lock_exclusive() const
+    {
+        if constexpr (is_shared)
+            upgrade_m_.lock();
+        m_.lock();
+    }
+    bool try_lock_exclusive() const
+    {
+        if constexpr (is_shared)
+        {
+            if (!upgrade_m_.try_lock())
+                return false;
+            if (!m_.try_lock())
+            {
+                upgrade_m_.unlock();
+                return false;
+            }
+            return true;
+        }
+        else
+            return m_.try_lock();
+    }
+    void unlock_exclusive() const
+    {
+        m_.unlock();
+        if constexpr (is_shared)
+            upgrade_m_.unlock();
+    }
+
+    // 写锁的 Lockable 包装，供 std::lock_guard 与 std::scoped_lock 使用
+    class exclusive_lockable
+    {
+        const synchronized *s_;
+
+    public:
+        explicit exclusive_lockable(const synchronized &s) noexcept : s_(&s) {}
+        void lock() { s_->lock_exclusive(); }
+        bool try_lock() { return s_->try_lock_exclusive(); }
+        void unlock() { s_->unlock_exclusive(); }
+    };
+
+public:
+    // 传给 with_upgrade 的访问句柄，析构时释放全部锁
+    class upgradable
+    {
+        synchronized &s_;
+        bool exclusive_;
+
+        friend class synchronized;
+        explicit upgradable(synchronized &s) : s_(s), exclusive_(!is_shared)
+        {
+            if constexpr (is_shared)
+            {
+                s_.upgrade_m_.lock();
+                s_.m_.lock_shared();
+            }
+            else
+                s_.m_.lock();
+        }
+
+    public:
+        upgradable(const upgradable &) = delete;
+        upgradable &operator=(const upgradable &) = delete;
+        ~upgradable()
+        {
+            if (exclusive_)
+                s_.m_.unlock();
+            else
+                s_.m_.unlock_shared();
+            if constexpr (is_shared)
+                s_.upgrade_m_.unlock();
+        }
+
+        const T &operator*() const noexcept { return s_.data_; }
+        const T *operator->() const noexcept { return &s_.data_; }
+
+        T &upgrade()
+        {
+            if (!exclusive_)
+            {
+                // 持有 upgrade_m_，没有写者能在这两步之间修改数据，之前读到的内容依然有效
+                s_.m_.unlock_shared();
+                s_.m_.lock();
+                exclusive_ = true;
+            }
+            return s_.data_;
+        }
+    };
+
+    synchronized() = default;
+    explicit synchronized(T value) : data_(std::move(value)) {}
+    template <typename... Args>
+    explicit synchronized(std::in_place_t, Args &&...args) : data_(std::forward<Args>(args)...) {}
+    synchronized(const synchronized &) = delete;
+    synchronized &operator=(const synchronized &) = delete;
+
+    template <typename Fn>
+    auto with_read(Fn &&fn) const
+    {
+        if constexpr (is_shared)
+        {
+            std::shared_lock<Mutex> lk{m_};
+            return std::invoke(std::forward<Fn>(fn), std::as_const(data_));
+        }
+        else
+        {
+            std::lock_guard<Mutex> lk{m_};
+            return std::invoke(std::forward<Fn>(fn), std::as_const(data_));
+        }
+    }
+
+    template <typename Fn>
+    auto with_write(Fn &&fn)
+    {
+        exclusive_lockable lockable{*this};
+        std::lock_guard<exclusive_lockable> lk{lockable};
+        return std::invoke(std::forward<Fn>(fn), data_);
+    }
+
+    template <typename Fn>
+    auto with_upgrade(Fn &&fn)
+    {
+        upgradable access{*this};
+        return std::invoke(std::forward<Fn>(fn), access);
+    }
+
+    T copy() const
+    {
+        return with_read([](const T &data)
+                         { return data; });
+    }
+};
+
+struct synchronized_access
+{
+    template <std::size_t... I, typename Tuple>
+    static auto with_locked(std::index_sequence<I...>, Tuple all)
+    {
+        // 同一个对象出现两次会对同一个互斥量上锁两次
+        std::array<const void *, sizeof...(I)> addresses{static_cast<const void *>(&std::get<I>(all))...};
+        std::sort(addresses.begin(), addresses.end());
+        assert(std::adjacent_find(addresses.begin(), addresses.end()) == addresses.end());
+
+        auto lockables = std::tuple{typename std::remove_reference_t<std::tuple_element_t<I, Tuple>>::exclusive_lockable{std::get<I>(all)}...};
+        return std::apply([&](auto &...locks)
+                          {
+            std::scoped_lock lk{locks...};
+            return std::invoke(std::get<sizeof...(I)>(all), std::get<I>(all).data_...); }, lockables);
+    }
+};
+
+// with_locked(a, b, ..., fn)：最后一个参数是函数，以 fn(a 的数据, b 的数据, ...) 调用
+template <typename... Args>
+    requires(sizeof...(Args) >= 2)
+auto with_locked(Args &&...args)
+{
+    return synchronized_access::with_locked(std::make_index_sequence<sizeof...(Args) - 1>{},
+                                            std::forward_as_tuple(std::forward<Args>(args)...));
+}
+
+class Data
+{
+    int a{};
+    std::string b{};
+
+public:
+    void do_something() { ++a; }
+    int value() const { return a; }
+};
+
+// 在读多写少的缓存上使用升级：命中时只用 with_read 持有共享锁，可以并发；
+// 未命中时才进入 with_upgrade（各个 with_upgrade 之间互斥），重新检查后升级为独占锁插入
+int cached_length(synchronized<std::map<std::string, int>> &cache, const std::string &key)
+{
+    auto cached = cache.with_read([&](const auto &map) -> std::optional<int>
+                                  {
+        if (auto it = map.find(key); it != map.end())
+            return it->second;
+        return std::nullopt; });
+    if (cached)
+        return *cached;
+    return cache.with_upgrade([&](auto &access)
+                              {
+        if (auto it = access->find(key); it != access->end())
+            return it->second;
+        return access.upgrade()[key] = static_cast<int>(key.size()); });
+}
+
+// VERSION_5 中 swap(a, b) 与 swap(b, a) 同时执行会死锁，with_locked 对任意锁类型都不会
+template <typename Mutex>
+void swap_test(const char *name)
+{
+    synchronized<std::string, Mutex> a{"🤣"}, b{"😅"};
+    {
+        std::jthread t1{[&]
+                        { for (int i = 0; i < 100000; ++i) with_locked(a, b, [](std::string &x, std::string &y) { std::swap(x, y); }); }};
+        std::jthread t2{[&]
+                        { for (int i = 0; i < 100001; ++i) with_locked(b, a, [](std::string &x, std::string &y) { std::swap(x, y); }); }};
+    }
+    std::cout << name << ": a = " << a.copy() << ", b = " << b.copy() << '\n'; // 交换了奇数次
+}
+
+int main()
+{
+    synchronized<Data> d;
+    d.with_write([](Data &data)
+                 { data.do_something(); });
+    std::cout << d.with_read([](const Data &data)
+                             { return data.value(); })
+              << '\n'; // 1
+
+    synchronized<std::map<std::string, int>> cache;
+    {
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < 4; ++t)
+            threads.emplace_back([&]
+                                 {
+                for (int i = 0; i < 10000; ++i)
+                    cached_length(cache, "key" + std::to_string(i % 100)); });
+    }
+    std::cout << "缓存条目: " << cache.with_read([](const auto &map)
+                                              { return map.size(); })
+              << '\n'; // 100
+
+    swap_test<std::mutex>("std::mutex");
+    swap_test<std::shared_mutex>("std::shared_mutex");
+    swap_test<spinlock_mutex>("spinlock_mutex");
+    swap_test<hybrid_mutex>("hybrid_mutex");
+}
+#elif defined(VERSION_18)
+// 运行时锁顺序图与死锁检测（仅调试构建）
+/*
+VERSION_5、VERSION_6 中 swap(a, b) 与 swap(b, a) 同时执行会死锁，但只在特定的时序下才会发生，发生时进程只是挂起
+锁顺序检测（思路来自 Linux 内核的 lockdep）：
+1: 每个线程记录自己当前持有的锁（持锁栈）
+2: 持有 A 时获取 B，就在全局图中加入一条边 A -> B，并保存此时的持锁栈与调用栈
+3: 加入新边之前检查图中是否已经存在 B => A 的路径，存在则说明两处代码以相反的顺序获取锁，即使这次没有真的死锁，也是潜在的死锁，报告双方的持锁栈与调用栈
+调用栈优先使用 C++23 的 std::stacktrace，否则在 glibc 上使用 backtrace()（链接时加 -rdynamic 才有函数名，也可以用 addr2line 解析地址）
+4: 层级模式：为互斥量声明层级，线程只能获取层级低于自己已持有的所有层级互斥量的锁，违反时抛出 std::logic_error（参考《C++ Concurrency in Action》的 hierarchical_mutex）
+默认按互斥量实例建图；构造时传入锁类名则同名的所有实例共用一个节点，可以发现不同实例之间的顺序问题，但同类锁嵌套也会被报告
+try_lock 不会阻塞，本身不会造成死锁，只入持锁栈、不加边
+编译时加 -DLOCK_ORDER_CHECKING 开启，并且定义 NDEBUG 时总是关闭；关闭时 checked_mutex 就是被包装的类型本身，没有任何额外开销
+*/
+
+#if defined(LOCK_ORDER_CHECKING) && !defined(NDEBUG)
+#include <version>
+#if defined(__cpp_lib_stacktrace)
+#include <stacktrace>
+#elif __has_include(<execinfo.h>)
+#include <execinfo.h>
+#endif
+
+struct lock_level
+{
+    unsigned value;
+};
+
+class lock_order_graph
+{
+public:
+    using node_id = std::uint64_t;
+
+    struct held_lock
+    {
+        node_id node;
+        std::optional<unsigned> level;
+    };
+
+    static lock_order_graph &instance()
+    {
+        static lock_order_graph graph;
+        return graph;
+    }
+
+    node_id register_instance(std::string name)
+    {
+        std::lock_guard<std::mutex> lk{m_};
+        node_id id = next_id_++;
+        names_.emplace(id, std::move(name));
+        return id;
+    }
+
+    node_id register_class(std::string_view name)
+    {
+        std::lock_guard<std::mutex> lk{m_};
+        auto [it, inserted] = classes_.try_emplace(std::string(name), next_id_);
+        if (inserted)
+            names_.emplace(next_id_++, std::string(name));
+        return it->second;
+    }
+
+    // 互斥量实例析构后，与之相关的边都已失效
+    void unregister_instance(node_id id)
+    {
+        std::lock_guard<std::mutex> lk{m_};
+        edges_.erase(id);
+        for (auto &[from, to] : edges_)
+            to.erase(id);
+        names_.erase(id);
+    }
+
+    // 阻塞获取之前调用：先检查，再真正去获取锁，这样在真的死锁之前就能得到报告
+    void before_lock(node_id id, std::optional<unsigned> level)
+    {
+        auto &held = held_locks();
+        check_hierarchy(id, level);
+        if (held.empty())
+            return;
+
+        std::lock_guard<std::mutex> lk{m_};
+        for (const auto &h : held)
+        {
+            if (h.node == id || edges_[h.node].contains(id))
+                continue;
+            std::string stacktrace = capture_stacktrace();
+            if (auto path = find_path(id, h.node))
+                report_cycle(*path, h.node, id, stacktrace);
+            edges_[h.node].emplace(id, edge_info{std::this_thread::get_id(), held_names(), std::move(stacktrace)});
+        }
+    }
+
+    void after_lock(node_id id, std::optional<unsigned> level)
+    {
+        held_locks().push_back({id, level});
+    }
+
+    void after_try_lock(node_id id, std::optional<unsigned> level)
+    {
+        check_hierarchy(id, level);
+        held_locks().push_back({id, level});
+    }
+
+    void after_unlock(node_id id)
+    {
+        auto &held = held_locks();
+        // 解锁顺序不一定与加锁相反，从栈顶向下找
+        auto it = std::find_if(held.rbegin(), held.rend(), [id](const held_lock &h)
+                               { return h.node == id; });
+        if (it != held.rend())
+            held.erase(std::next(it).base());
+    }
+
+    std::size_t reports() const noexcept { return reports_.load(std::memory_order_relaxed); }
+
+private:
+    struct edge_info
+    {
+        std::thread::id thread;
+        std::vector<std::string> held; // 加边时的持锁栈
+        std::string stacktrace;
+    };
+
+    std::mutex m_;
+    node_id next_id_ = 1;
+    std::unordered_map<node_id, std::string> names_;
+    std::unordered_map<std::string, node_id> classes_;
+    std::unordered_map<node_id, std::unordered_map<node_id, edge_info>> edges_;
+    std::atomic<std::size_t> reports_{0};
+
+    static std::vector<held_lock> &held_locks()
+    {
+        thread_local std::vector<held_lock> held;
+        return held;
+    }
+
+    // 调用时已持有 m_
+    std::vector<std::string> held_names()
+    {
+        std::vector<std::string> names;
+        for (const auto &h : held_locks())
+            names.push_back(names_[h.node]);
+        return names;
+    }
+
+    std::string name_of(node_id id)
+    {
+        std::lock_guard<std::mutex> lk{m_};
+        return names_[id];
+    }
+
+    static std::string capture_stacktrace()
+    {
+#if defined(__cpp_lib_stacktrace)
+        return std::to_string(std::stacktrace::current(2));
+#elif __has_include(<execinfo.h>)
+        std::array<void *, 32> frames;
+        int count = ::backtrace(frames.data(), static_cast<int>(frames.size()));
+        std::string result;
+        if (char **symbols = ::backtrace_symbols(frames.data(), count))
+        {
+            for (int i = 2; i < count; ++i) // 跳过检测器自身的两层
+                result += std::string("      ") + symbols[i] + '\n';
+            std::free(symbols);
+        }
+        return result;
+#else
+        return {};
+#endif
+    }
+
+    void check_hierarchy(node_id id, std::optional<unsigned> level)
+    {
+        if (!level)
+            return;
+        for (const auto &h : held_locks())
+        {
+            if (h.level && *h.level <= *level && h.node != id)
+            {
+                throw std::logic_error("违反锁层级: 持有层级 " + std::to_string(*h.level) + " 的 " + name_of(h.node) +
+                                       " 时获取层级 " + std::to_string(*level) + " 的 " + name_of(id));
+            }
+        }
+    }
+
+    // 广度优先搜索 from => to 的路径，返回路径上的节点
+    std::optional<std::vector<node_id>> find_path(node_id from, node_id to)
+    {
+        std::unordered_map<node_id, node_id> parent{{from, from}};
+        std::queue<node_id> pending;
+        pending.push(from);
+        while (!pending.empty())
+        {
+            node_id n = pending.front();
+            pending.pop();
+            if (n == to)
+            {
+                std::vector<node_id> path{to};
+                while (path.back() != from)
+                    path.push_back(parent[path.back()]);
+                std::reverse(path.begin(), path.end());
+                return path;
+            }
+            if (auto it = edges_.find(n); it != edges_.end())
+                for (const auto &[next, info] : it->second)
+                    if (parent.try_emplace(next, n).second)
+                        pending.push(next);
+        }
+        return std::nullopt;
+    }
+
+    static void print_held(std::ostream &os, const std::vector<std::string> &held)
+    {
+        os << "    持锁栈:";
+        for (const auto &name : held)
+            os << ' ' << name;
+        os << "\n    调用栈:\n";
+    }
+
+    // 调用时已持有 m_
+    void report_cycle(const std::vector<node_id> &path, node_id held, node_id acquiring, const std::string &stacktrace)
+    {
+        reports_.fetch_add(1, std::memory_order_relaxed);
+        std::osyncstream os{std::cerr};
+        os << "==== 潜在死锁：锁顺序出现环 ====\n"
+           << "线程 " << std::this_thread::get_id() << " 持有 " << names_[held] << " 时获取 " << names_[acquiring] << '\n';
+        print_held(os, held_names());
+        os << stacktrace;
+        for (std::size_t i = 0; i + 1 < path.size(); ++i)
+        {
+            const edge_info &info = edges_[path[i]][path[i + 1]];
+            os << "此前线程 " << info.thread << " 持有 " << names_[path[i]] << " 时获取 " << names_[path[i + 1]] << '\n';
+            print_held(os, info.held);
+            os << info.stacktrace;
+        }
+    }
+};
+
+template <typename Mutex>
+class checked_mutex
+{
+    Mutex m_;
+    lock_order_graph::node_id id_;
+    bool owns_node_;
+    std::optional<unsigned> level_;
+
+    std::string instance_name(std::source_location loc) const
+    {
+        std::ostringstream os;
+        os << loc.file_name() << ':' << loc.line() << '@' << static_cast<const void *>(this);
+        return os.str();
+    }
+
+public:
+    // 按实例建图，节点以声明位置与地址命名（同一个类的成员互斥量声明位置相同）
+    explicit checked_mutex(std::source_location loc = std::source_location::current())
+        : id_(lock_order_graph::instance().register_instance(instance_name(loc))), owns_node_(true) {}
+    // 按锁类建图
+    explicit checked_mutex(std::string_view lock_class)
+        : id_(lock_order_graph::instance().register_class(lock_class)), owns_node_(false) {}
+    // 层级模式
+    explicit checked_mutex(lock_level level, std::source_location loc = std::source_location::current())
+        : checked_mutex(loc)
+    {
+        level_ = level.value;
+    }
+    checked_mutex(const checked_mutex &) = delete;
+    checked_mutex &operator=(const checked_mutex &) = delete;
+    ~checked_mutex()
+    {
+        if (owns_node_)
+            lock_order_graph::instance().unregister_instance(id_);
+    }
+
+    void lock()
+    {
+        auto &graph = lock_order_graph::instance();
+        graph.before_lock(id_, level_);
+        m_.lock();
+        graph.after_lock(id_, level_);
+    }
+    bool try_lock()
+    {
+        if (!m_.try_lock())
+            return false;
+        try
+        {
+            lock_order_graph::instance().after_try_lock(id_, level_);
+        }
+        catch (...)
+        {
+            m_.unlock();
+            throw;
+        }
+        return true;
+    }
+    void unlock()
+    {
+        lock_order_graph::instance().after_unlock(id_);
+        m_.unlock();
+    }
+
+    void lock_shared()
+        requires requires(Mutex m) { m.lock_shared(); }
+    {
+        auto &graph = lock_order_graph::instance();
+        graph.before_lock(id_, level_);
+        m_.lock_shared();
+        graph.after_lock(id_, level_);
+    }
+    bool try_lock_shared()
+        requires requires(Mutex m) { m.try_lock_shared(); }
+    {
+        if (!m_.try_lock_shared())
+            return false;
+        try
+        {
+            lock_order_graph::instance().after_try_lock(id_, level_);
+        }
+        catch (...)
+        {
+            m_.unlock_shared();
+            throw;
+        }
+        return true;
+    }
+    void unlock_shared()
+        requires requires(Mutex m) { m.unlock_shared(); }
+    {
+        lock_order_graph::instance().after_unlock(id_);
+        m_.unlock_shared();
+    }
+};
+#else
+struct lock_level
+{
+    unsigned value;
+};
+
+template <typename Mutex>
+class checked_mutex : public Mutex
+{
+public:
+    checked_mutex() = default;
+    explicit checked_mutex(std::string_view) {}
+    explicit checked_mutex(lock_level) {}
+};
+#endif
+
+// VERSION_5 的 swap：两个线程以相反的顺序获取 a.m 与 b.m
+// 这里让两个线程先后执行，实际不会死锁，但检测器依然能够报告这个潜在的死锁
+struct X
+{
+    X(const std::string &str) : object{str} {}
+    friend void swap(X &lhs, X &rhs);
+
+private:
+    std::string object;
+    checked_mutex<std::mutex> m;
+};
+
+void swap(X &lhs, X &rhs)
+{
+    if (&lhs == &rhs)
+        return;
+    std::lock_guard<checked_mutex<std::mutex>> lock1{lhs.m};
+    std::lock_guard<checked_mutex<std::mutex>> lock2{rhs.m};
+    std::swap(lhs.object, rhs.object);
+}
+
+checked_mutex<std::mutex> high_level_mutex{lock_level{10000}};
+checked_mutex<std::shared_mutex> low_level_mutex{lock_level{5000}};
+
+int main()
+{
+    X a{"🤣"}, b{"😅"};
+    std::jthread{[&]
+                 { swap(a, b); }}
+        .join();
+    std::jthread{[&]
+                 { swap(b, a); }}
+        .join();
+
+    // 层级从高到低获取，没有问题
+    {
+        std::lock_guard<checked_mutex<std::mutex>> lk1{high_level_mutex};
+        std::shared_lock<checked_mutex<std::shared_mutex>> lk2{low_level_mutex};
+    }
+    // 层级从低到高获取，违反层级
+    try
+    {
+        std::shared_lock<checked_mutex<std::shared_mutex>> lk1{low_level_mutex};
+        std::lock_guard<checked_mutex<std::mutex>> lk2{high_level_mutex};
+    }
+    catch (const std::logic_error &e)
+    {
+        std::cout << e.what() << '\n';
+    }
+}
+#elif defined(VERSION_19)
+// 基于 thread_local 的分片统计计数器
+/*
+VERSION_12 中的 global_counter 存在数据竞争；改成 std::atomic 又会让所有线程争抢同一个缓存行，计数本身成为瓶颈
+分片计数器：
+1: 每个线程第一次写入时登记一个独占的、按缓存行对齐的槽，之后只写自己的槽。槽只有一个写者，用 relaxed 的 load + store 即可，不需要带 lock 前缀的读-改-写
+2: 读取时加锁遍历所有存活线程的槽，再加上已退出线程留下的累计值，得到 sum、max 或直方图
+3: 线程退出时（thread_local 析构）把槽的值合并进累计值并注销；计数器先于线程销毁也是安全的：槽随注册表释放，线程只持有注册表的 weak_ptr
+读取只是一个近似的快照（各个槽不是在同一时刻读取的），这对统计指标足够了
+*/
+
+constexpr std::size_t cache_line_size = 64;
+
+// 注册表的类型擦除接口，供线程退出时调用
+struct shard_registry_base
+{
+    virtual ~shard_registry_base() = default;
+    virtual void retire(void *slot) = 0;
+};
+
+// 每个线程持有的所有分片，按计数器的稠密下标索引
+/*
+热路径上的查找只是一次下标访问加一次 epoch 比较，与线程用过多少个计数器无关
+下标在计数器析构时回收并被之后创建的计数器复用，因此每个线程的表长不超过同时存活的计数器数量；
+epoch 全局唯一，用来识别下标被复用后残留的旧条目，查找时发现旧条目就地清理
+槽由计数器的注册表持有，计数器析构时随注册表一起释放，不会等到线程退出
+*/
+class thread_shards
+{
+    struct entry
+    {
+        std::uint64_t epoch = 0;
+        std::weak_ptr<shard_registry_base> registry;
+        void *slot = nullptr;
+    };
+    std::vector<entry> entries_;
+
+    struct index_allocator
+    {
+        std::mutex m;
+        std::vector<std::size_t> free;
+        std::size_t next = 0;
+    };
+    static index_allocator &indices()
+    {
+        static index_allocator a;
+        return a;
+    }
+
+    // 注册表还活着（计数器仍存在）时交给它合并并释放槽，否则槽已随注册表释放
+    static void drop(entry &e)
+    {
+        if (auto registry = e.registry.lock())
+            registry->retire(e.slot);
+        e = entry{};
+    }
+
+public:
+    // 所有类型的分片计数器共用同一个 epoch 序列
+    static std::uint64_t next_epoch() noexcept
+    {
+        static std::atomic<std::uint64_t> epoch{1};
+        return epoch.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static std::size_t acquire_index()
+    {
+        auto &a = indices();
+        std::lock_guard<std::mutex> lk{a.m};
+        if (a.free.empty())
+            return a.next++;
+        std::size_t index = a.free.back();
+        a.free.pop_back();
+        return index;
+    }
+
+    static void release_index(std::size_t index)
+    {
+        auto &a = indices();
+        std::lock_guard<std::mutex> lk{a.m};
+        a.free.push_back(index);
+    }
+
+    static thread_shards &local()
+    {
+        thread_local thread_shards shards;
+        return shards;
+    }
+
+    void *find(std::size_t index, std::uint64_t epoch) const noexcept
+    {
+        if (index < entries_.size() && entries_[index].epoch == epoch)
+            return entries_[index].slot;
+        return nullptr;
+    }
+
+    void add(std::size_t index, std::uint64_t epoch, std::weak_ptr<shard_registry_base> registry, void *slot)
+    {
+        if (index >= entries_.size())
+            entries_.resize(index + 1);
+        else if (entries_[index].epoch != 0)
+            drop(entries_[index]); // 下标被复用，清理旧计数器留下的条目
+        entries_[index] = {epoch, std::move(registry), slot};
+    }
+
+    ~thread_shards()
+    {
+        for (auto &e : entries_)
+            if (e.epoch != 0)
+                drop(e);
+    }
+};
+
+// Slot 需要提供 fold(Slot &into) const，把自己的值合并进已退出线程的累计值
+template <typename Slot>
+class thread_sharded
+{
+    struct registry : shard_registry_base
+    {
+        std::mutex m;
+        Slot retired;
+        std::vector<std::unique_ptr<Slot>> live;
+
+        void retire(void *slot) override
+        {
+            auto *s = static_cast<Slot *>(slot);
+            std::lock_guard<std::mutex> lk{m};
+            s->fold(retired);
+            std::erase_if(live, [s](const auto &p)
+                          { return p.get() == s; });
+        }
+    };
+
+    std::size_t index_ = thread_shards::acquire_index();
+    std::uint64_t epoch_ = thread_shards::next_epoch();
+    std::shared_ptr<registry> registry_ = std::make_shared<registry>();
+
+    Slot &register_slot()
+    {
+        Slot *slot;
+        {
+            std::lock_guard<std::mutex> lk{registry_->m};
+            slot = registry_->live.emplace_back(std::make_unique<Slot>()).get();
+        }
+        thread_shards::local().add(index_, epoch_, registry_, slot);
+        return *slot;
+    }
+
+public:
+    thread_sharded() = default;
+    thread_sharded(const thread_sharded &) = delete;
+    thread_sharded &operator=(const thread_sharded &) = delete;
+    ~thread_sharded() { thread_shards::release_index(index_); }
+
+    // 当前线程的槽
+    Slot &local()
+    {
+        if (void *slot = thread_shards::local().find(index_, epoch_))
+            return *static_cast<Slot *>(slot);
+        return register_slot();
+    }
+
+    // 依次以已退出线程的累计值、各存活线程的槽调用 fn
+    template <typename Fn>
+    void for_each_slot(Fn fn) const
+    {
+        std::lock_guard<std::mutex> lk{registry_->m};
+        fn(std::as_const(registry_->retired));
+        for (const auto &slot : registry_->live)
+            fn(*slot);
+    }
+};
+
+// 单写者槽上的递增：只有所属线程写，读者可能并发读取，因此仍然是原子变量，但不需要读-改-写
+inline void single_writer_add(std::atomic<std::int64_t> &a, std::int64_t n) noexcept
+{
+    a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+class sharded_counter
+{
+    struct alignas(cache_line_size) slot
+    {
+        std::atomic<std::int64_t> value{0};
+        void fold(slot &into) const { single_writer_add(into.value, value.load(std::memory_order_relaxed)); }
+    };
+    thread_sharded<slot> shards_;
+
+public:
+    void add(std::int64_t n = 1) { single_writer_add(shards_.local().value, n); }
+    sharded_counter &operator++()
+    {
+        add(1);
+        return *this;
+    }
+
+    std::int64_t sum() const
+    {
+        std::int64_t total = 0;
+        shards_.for_each_slot([&](const slot &s)
+                              { total += s.value.load(std::memory_order_relaxed); });
+        return total;
+    }
+};
+
+class sharded_max
+{
+    struct alignas(cache_line_size) slot
+    {
+        std::atomic<std::int64_t> value{std::numeric_limits<std::int64_t>::min()};
+        void fold(slot &into) const
+        {
+            into.value.store(std::max(into.value.load(std::memory_order_relaxed), value.load(std::memory_order_relaxed)),
+                             std::memory_order_relaxed);
+        }
+    };
+    thread_sharded<slot> shards_;
+
+public:
+    void update(std::int64_t v)
+    {
+        auto &value = shards_.local().value;
+        if (v > value.load(std::memory_order_relaxed))
+            value.store(v, std::memory_order_relaxed);
+    }
+
+    // 没有任何记录时返回 std::numeric_limits<std::int64_t>::min()
+    std::int64_t max() const
+    {
+        std::int64_t result = std::numeric_limits<std::int64_t>::min();
+        shards_.for_each_slot([&](const slot &s)
+                              { result = std::max(result, s.value.load(std::memory_order_relaxed)); });
+        return result;
+    }
+};
+
+// 按 2 的幂分桶的直方图，第 i 个桶：[2^(i-1), 2^i)，0 单独在第 0 个桶
+class sharded_histogram
+{
+public:
+    static constexpr std::size_t bucket_count = 65;
+    using snapshot = std::array<std::uint64_t, bucket_count>;
+
+    void record(std::uint64_t v)
+    {
+        auto &bucket = shards_.local().buckets[std::bit_width(v)];
+        single_writer_add(bucket, 1);
+    }
+
+    snapshot buckets() const
+    {
+        snapshot result{};
+        shards_.for_each_slot([&](const slot &s)
+                              {
+            for (std::size_t i = 0; i < bucket_count; ++i)
+                result[i] += static_cast<std::uint64_t>(s.buckets[i].load(std::memory_order_relaxed)); });
+        return result;
+    }
+
+    std::uint64_t count() const
+    {
+        auto b = buckets();
+        return std::accumulate(b.begin(), b.end(), std::uint64_t{0});
+    }
+
+    // 分位数所在桶的上界（近似值）
+    std::uint64_t percentile_upper_bound(double p) const
+    {
+        auto b = buckets();
+        auto total = std::accumulate(b.begin(), b.end(), std::uint64_t{0});
+        auto target = static_cast<std::uint64_t>(std::ceil(p * static_cast<double>(total)));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucket_count; ++i)
+        {
+            seen += b[i];
+            if (seen >= target && seen > 0)
+                return i == 0 ? 0 : (i >= 64 ? std::numeric_limits<std::uint64_t>::max() : (std::uint64_t{1} << i) - 1);
+        }
+        return 0;
+    }
+
+private:
+    struct alignas(cache_line_size) slot
+    {
+        std::array<std::atomic<std::int64_t>, bucket_count> buckets{};
+        void fold(slot &into) const
+        {
+            for (std::size_t i = 0; i < bucket_count; ++i)
+                single_writer_add(into.buckets[i], buckets[i].load(std::memory_order_relaxed));
+        }
+    };
+    thread_sharded<slot> shards_;
+};
+
+// 多个线程对同一个计数器递增：std::atomic::fetch_add 与分片计数器
+template <typename Increment>
+double increment_benchmark(std::size_t num_threads, std::size_t iterations, Increment increment)
+{
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t t = 0; t < num_threads; ++t)
+            threads.emplace_back([&]
+                                 {
+                for (std::size_t i = 0; i < iterations; ++i)
+                    increment(); });
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / (num_threads * iterations);
+}
+
+int main()
+{
+    sharded_counter requests;
+    sharded_max max_latency;
+    sharded_histogram latency;
+    {
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < 4; ++t)
+            threads.emplace_back([&, t]
+                                 {
+                for (std::uint64_t i = 0; i < 1000; ++i)
+                {
+                    ++requests;
+                    max_latency.update(static_cast<std::int64_t>(i * (t + 1)));
+                    latency.record(i);
+                } });
+    }
+    // 线程都已退出，它们的计数已经合并进累计值
+    ++requests;
+    std::cout << "requests: " << requests.sum() << '\n';             // 4001
+    std::cout << "max latency: " << max_latency.max() << '\n';       // 3996
+    std::cout << "latency count: " << latency.count() << '\n';       // 4000
+    std::cout << "p99 <= " << latency.percentile_upper_bound(0.99) << '\n';
+
+    constexpr std::size_t iterations = 10'000'000;
+    std::size_t max_threads = std::max(4u, std::thread::hardware_concurrency());
+    std::cout << "线程数\tatomic::fetch_add\tsharded_counter（纳秒/次）\n";
+    for (std::size_t n = 1; n <= max_threads; n *= 2)
+    {
+        std::atomic<std::int64_t> global_counter{0};
+        sharded_counter counter;
+        std::cout << n << '\t'
+                  << increment_benchmark(n, iterations, [&]
+                                         { global_counter.fetch_add(1, std::memory_order_relaxed); })
+                  << '\t'
+                  << increment_benchmark(n, iterations, [&]
+                                         { ++counter; })
+                  << '\n';
+        assert(counter.sum() == global_counter.load());
+    }
+}
 #endif
\ No newline at end of file
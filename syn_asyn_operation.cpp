@@ -1,7 +1,13 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <barrier>
+#include <cassert>
+#include <chrono>
 #include <cmath>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <exception>
 #include <format>
 #include <functional>
@@ -9,6 +15,7 @@
 #include <iostream>
 #include <iterator>
 #include <latch>
+#include <limits>
 #include <list>
 #include <map>
 #include <memory>
@@ -19,9 +26,13 @@
 #include <random>
 #include <semaphore>
 #include <shared_mutex>
+#include <stdexcept>
 #include <string>
 #include <syncstream>
 #include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 using namespace std::chrono_literals;
 
@@ -31,7 +42,7 @@ using namespace std::chrono_literals;
 在多线程编程中，各个任务通常需要通过**同步设施**进行相互**协调和等待**，以确保数据的**一致性**和**正确性**
 */
 
-#define VERSION_17
+#define VERSION_22
 #ifdef VERSION_1
 /*
 等待事件及条件
@@ -1144,4 +1155,1370 @@ int main()
 #endif
 }
 
+#elif defined(VERSION_18)
+// 基于 std::barrier 的批量同步并行（BSP）引擎
+/*
+VERSION_15 中每一轮的工作都由 barrier 划分，迭代求解（模板计算、松弛迭代）正是这样的结构：
+1: 一组常驻的工作线程，每个阶段各自对自己的分区执行 step(phase, partition)
+2: 所有分区完成后在 barrier 的完成函数中执行一次 end_phase(phase)：检查收敛、交换双缓冲，必须是 noexcept 的（与 std::barrier 的要求相同）
+3: end_phase 返回 false 或达到最大阶段数时提前结束；step 抛出的异常会结束计算，并在 run() 中重新抛出
+工作线程在多次 run() 之间常驻，不必每次都创建线程；run() 之间工作线程在 atomic::wait 上睡眠
+*/
+
+class bsp_engine
+{
+public:
+    struct partition
+    {
+        std::size_t worker;
+        std::size_t begin;
+        std::size_t end;
+    };
+
+    explicit bsp_engine(std::size_t num_workers = std::thread::hardware_concurrency())
+        : num_workers_(std::max<std::size_t>(1, num_workers)),
+          barrier_(static_cast<std::ptrdiff_t>(num_workers_), completion{this})
+    {
+        for (std::size_t i = 0; i < num_workers_; ++i)
+            workers_.emplace_back([this, i]
+                                  { worker_loop(i); });
+    }
+    bsp_engine(const bsp_engine &) = delete;
+    bsp_engine &operator=(const bsp_engine &) = delete;
+
+    ~bsp_engine()
+    {
+        shutdown_.store(true, std::memory_order_relaxed);
+        generation_.fetch_add(1, std::memory_order_release);
+        generation_.notify_all();
+        // 先汇合工作线程，它们还会访问 generation_ 等成员，不能等到成员析构时才 join
+        workers_.clear();
+    }
+
+    std::size_t size() const noexcept { return num_workers_; }
+
+    // 将 [0, size) 均分给各个工作线程，返回实际执行的阶段数
+    template <typename Step, typename EndPhase>
+    std::size_t run(std::size_t size, std::size_t max_phases, Step &&step, EndPhase &&end_phase)
+    {
+        static_assert(std::is_invocable_v<Step &, std::size_t, partition>);
+        static_assert(std::is_nothrow_invocable_r_v<bool, EndPhase &, std::size_t>, "end_phase 必须是 noexcept 的");
+        std::lock_guard<std::mutex> lk{run_mutex_};
+        if (max_phases == 0)
+            return 0;
+
+        size_ = size;
+        max_phases_ = max_phases;
+        phase_ = 0;
+        stop_ = false;
+        error_ = nullptr;
+        failed_.store(false, std::memory_order_relaxed);
+        step_obj_ = std::addressof(step);
+        step_fn_ = [](void *obj, std::size_t phase, partition p)
+        { (*static_cast<std::remove_reference_t<Step> *>(obj))(phase, p); };
+        end_obj_ = std::addressof(end_phase);
+        end_fn_ = [](void *obj, std::size_t phase) noexcept
+        { return static_cast<bool>((*static_cast<std::remove_reference_t<EndPhase> *>(obj))(phase)); };
+
+        remaining_.store(num_workers_, std::memory_order_relaxed);
+        generation_.fetch_add(1, std::memory_order_release);
+        generation_.notify_all();
+        for (std::size_t r = remaining_.load(std::memory_order_acquire); r != 0; r = remaining_.load(std::memory_order_acquire))
+            remaining_.wait(r, std::memory_order_acquire);
+
+        if (error_)
+            std::rethrow_exception(error_);
+        return phase_;
+    }
+
+private:
+    struct completion
+    {
+        bsp_engine *engine;
+        void operator()() noexcept { engine->complete_phase(); }
+    };
+
+    std::size_t num_workers_;
+    std::barrier<completion> barrier_;
+    std::vector<std::jthread> workers_;
+
+    std::mutex run_mutex_;
+    std::atomic<std::uint64_t> generation_{0};
+    std::atomic<std::size_t> remaining_{0};
+    std::atomic_bool shutdown_{false};
+
+    // 以下成员只在 run() 开始时（工作线程睡眠中）或 barrier 的完成函数中（其它线程都阻塞在 barrier 上）写入
+    std::size_t size_ = 0;
+    std::size_t max_phases_ = 0;
+    std::size_t phase_ = 0;
+    bool stop_ = false;
+    void *step_obj_ = nullptr;
+    void (*step_fn_)(void *, std::size_t, partition) = nullptr;
+    void *end_obj_ = nullptr;
+    bool (*end_fn_)(void *, std::size_t) noexcept = nullptr;
+
+    std::atomic_bool failed_{false};
+    std::mutex error_mutex_;
+    std::exception_ptr error_;
+
+    partition partition_of(std::size_t worker) const noexcept
+    {
+        std::size_t chunk = size_ / num_workers_, remainder = size_ % num_workers_;
+        std::size_t begin = worker * chunk + std::min(worker, remainder);
+        return {worker, begin, begin + chunk + (worker < remainder ? 1 : 0)};
+    }
+
+    void complete_phase() noexcept
+    {
+        bool keep_going = !failed_.load(std::memory_order_relaxed) && end_fn_(end_obj_, phase_);
+        ++phase_;
+        stop_ = !keep_going || phase_ >= max_phases_;
+    }
+
+    void worker_loop(std::size_t index)
+    {
+        std::uint64_t seen = 0;
+        for (;;)
+        {
+            generation_.wait(seen, std::memory_order_acquire);
+            seen = generation_.load(std::memory_order_acquire);
+            if (shutdown_.load(std::memory_order_relaxed))
+                return;
+
+            const partition p = partition_of(index);
+            bool stop = false;
+            while (!stop)
+            {
+                try
+                {
+                    if (!failed_.load(std::memory_order_relaxed))
+                        step_fn_(step_obj_, phase_, p);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lk{error_mutex_};
+                    if (!error_)
+                        error_ = std::current_exception();
+                    failed_.store(true, std::memory_order_relaxed);
+                }
+                // 出错的线程也必须到达 barrier，否则其它线程会永远等待
+                barrier_.arrive_and_wait();
+                stop = stop_;
+            }
+            if (remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                remaining_.notify_all();
+        }
+    }
+};
+
+// 双缓冲：每个阶段从 current() 读、向 next() 写，在阶段完成函数中 swap()
+template <typename T>
+class double_buffer
+{
+    std::array<std::vector<T>, 2> buffers_;
+    std::size_t current_ = 0;
+
+public:
+    explicit double_buffer(std::size_t n, const T &value = T{}) : buffers_{std::vector<T>(n, value), std::vector<T>(n, value)} {}
+
+    const std::vector<T> &current() const noexcept { return buffers_[current_]; }
+    std::vector<T> &current() noexcept { return buffers_[current_]; }
+    std::vector<T> &next() noexcept { return buffers_[current_ ^ 1]; }
+    void swap() noexcept { current_ ^= 1; }
+};
+
+// 每个工作线程一个，按缓存行对齐，避免伪共享
+struct alignas(64) padded_double
+{
+    double value = 0;
+};
+
+// 二维 Jacobi 迭代：求解拉普拉斯方程，上边界为 1，其余边界为 0
+struct jacobi_problem
+{
+    std::size_t n;
+    double_buffer<double> grid;
+
+    explicit jacobi_problem(std::size_t n) : n(n), grid(n * n)
+    {
+        for (std::size_t j = 0; j < n; ++j)
+            grid.current()[j] = grid.next()[j] = 1.0;
+    }
+
+    // 更新内部的第 [row_begin, row_end) 行（不含边界），返回最大变化量
+    double relax(std::size_t row_begin, std::size_t row_end)
+    {
+        const auto &u = grid.current();
+        auto &v = grid.next();
+        double diff = 0;
+        for (std::size_t i = row_begin; i < row_end; ++i)
+        {
+            for (std::size_t j = 1; j + 1 < n; ++j)
+            {
+                double value = 0.25 * (u[(i - 1) * n + j] + u[(i + 1) * n + j] + u[i * n + j - 1] + u[i * n + j + 1]);
+                diff = std::max(diff, std::abs(value - u[i * n + j]));
+                v[i * n + j] = value;
+            }
+        }
+        return diff;
+    }
+};
+
+constexpr double tolerance = 1e-5;
+
+std::size_t solve_sequential(jacobi_problem &problem, std::size_t max_phases)
+{
+    for (std::size_t phase = 0; phase < max_phases;)
+    {
+        double diff = problem.relax(1, problem.n - 1);
+        problem.grid.swap();
+        if (++phase, diff < tolerance)
+            return phase;
+    }
+    return max_phases;
+}
+
+// 对照：每个阶段都创建一批线程，结束时 join
+std::size_t solve_spawn_per_phase(jacobi_problem &problem, std::size_t max_phases, std::size_t num_threads)
+{
+    std::vector<padded_double> diffs(num_threads);
+    std::size_t rows = problem.n - 2;
+    for (std::size_t phase = 0; phase < max_phases;)
+    {
+        {
+            std::vector<std::jthread> threads;
+            for (std::size_t t = 0; t < num_threads; ++t)
+                threads.emplace_back([&, t]
+                                     { diffs[t].value = problem.relax(1 + rows * t / num_threads, 1 + rows * (t + 1) / num_threads); });
+        }
+        problem.grid.swap();
+        double diff = 0;
+        for (auto &d : diffs)
+            diff = std::max(diff, d.value);
+        if (++phase, diff < tolerance)
+            return phase;
+    }
+    return max_phases;
+}
+
+std::size_t solve_bsp(bsp_engine &engine, jacobi_problem &problem, std::size_t max_phases)
+{
+    std::vector<padded_double> diffs(engine.size());
+    return engine.run(
+        problem.n - 2, max_phases,
+        [&](std::size_t, bsp_engine::partition p)
+        { diffs[p.worker].value = problem.relax(1 + p.begin, 1 + p.end); },
+        [&](std::size_t) noexcept
+        {
+            problem.grid.swap();
+            double diff = 0;
+            for (auto &d : diffs)
+                diff = std::max(diff, d.value);
+            return diff >= tolerance; // 收敛后提前结束
+        });
+}
+
+template <typename F>
+double measure_ms(F &&f)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::forward<F>(f)();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+    std::size_t num_threads = std::max(4u, std::thread::hardware_concurrency());
+    bsp_engine engine{num_threads};
+
+    // step 抛出的异常在 run() 中重新抛出，引擎之后仍然可用
+    try
+    {
+        engine.run(100, 10, [](std::size_t phase, bsp_engine::partition p)
+                   {
+            if (phase == 3 && p.worker == 1)
+                throw std::runtime_error("第 3 阶段失败"); }, [](std::size_t) noexcept
+                   { return true; });
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "捕获异常: " << e.what() << '\n';
+    }
+
+    for (std::size_t n : {128u, 512u})
+    {
+        constexpr std::size_t max_phases = 2000;
+        jacobi_problem seq{n}, spawn{n}, bsp{n};
+        std::size_t phases[3];
+        double ms[3] = {
+            measure_ms([&]
+                       { phases[0] = solve_sequential(seq, max_phases); }),
+            measure_ms([&]
+                       { phases[1] = solve_spawn_per_phase(spawn, max_phases, num_threads); }),
+            measure_ms([&]
+                       { phases[2] = solve_bsp(engine, bsp, max_phases); }),
+        };
+        std::cout << n << " x " << n << " 网格，" << num_threads << " 个线程\n"
+                  << "  串行:           " << ms[0] << " ms, " << phases[0] << " 个阶段\n"
+                  << "  每阶段创建线程: " << ms[1] << " ms, " << phases[1] << " 个阶段\n"
+                  << "  bsp_engine:     " << ms[2] << " ms, " << phases[2] << " 个阶段\n"
+                  << std::boolalpha << "  结果一致: " << (seq.grid.current() == bsp.grid.current() && spawn.grid.current() == bsp.grid.current()) << '\n';
+    }
+}
+
+#elif defined(VERSION_19)
+// 可扩展的组合树屏障
+/*
+std::barrier 的实现通常让所有线程对同一个计数器做原子减法，线程数多时这个缓存行会在核心之间来回传递，成为 VERSION_15 中阶段循环的热点
+组合树屏障把参与者按 fan_in 个一组分到叶子节点上，每组最后一个到达的线程再到父节点上代表整组到达，最终只有一个线程到达根节点：
+1: 每个计数器最多被 fan_in 个线程竞争，到达操作的争用从 O(n) 降到 O(fan_in)，路径长度为 O(log n)
+2: 到达根节点的线程执行完成函数，然后推进阶段号唤醒所有等待者；每个核心都有参与者时等待者先自旋一小段时间，再通过 atomic::wait 挂起
+3: arrive_and_drop 与 std::barrier 语义相同：本阶段计入到达，并把后继阶段的期待计数减 1；
+   退出不会立即修改节点的期待计数（同一阶段的其它线程还在用它判断自己是不是最后一个），而是由该节点本阶段最后到达的线程统一扣除，
+   节点的期待计数减为 0 时，该节点也从父节点中退出
+线程在第一次到达时领取一个槽位并记在 thread_local 中，之后总是到达同一个叶子，因此参与者必须是固定的一组线程（阶段循环正是如此），
+不同于 std::barrier 允许任意线程代为到达
+*/
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+inline void cpu_relax() noexcept { _mm_pause(); }
+#elif defined(__aarch64__)
+inline void cpu_relax() noexcept { asm volatile("yield"); }
+#else
+inline void cpu_relax() noexcept {}
+#endif
+
+// 所有屏障共用一个编号生成器：按模板实例分别计数会让不同类型的屏障得到相同的编号
+inline std::uint64_t next_barrier_id() noexcept
+{
+    static std::atomic<std::uint64_t> id{0};
+    return id.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+struct noop_completion
+{
+    void operator()() noexcept {}
+};
+
+template <typename CompletionFunction = noop_completion>
+class tree_barrier
+{
+    static_assert(std::is_nothrow_invocable_v<CompletionFunction &>, "完成函数必须是 noexcept 的");
+
+    static constexpr std::size_t fan_in = 4;
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    struct alignas(64) node
+    {
+        std::atomic<std::size_t> count{0};    // 本阶段已到达的数量
+        std::atomic<std::size_t> expected{0}; // 每阶段期待的到达数量
+        std::atomic<std::size_t> drops{0};    // 本阶段到达时声明退出的数量
+        std::size_t parent = npos;
+    };
+
+    std::size_t participants_;
+    std::unique_ptr<node[]> nodes_;
+    CompletionFunction completion_;
+    std::atomic<std::uint64_t> phase_{0};
+    std::atomic<std::size_t> next_slot_{0};
+    const std::uint64_t id_ = next_barrier_id();
+    int spin_limit_ = 0;
+
+public:
+    explicit tree_barrier(std::ptrdiff_t expected, CompletionFunction completion = CompletionFunction())
+        : participants_(static_cast<std::size_t>(expected)), completion_(std::move(completion))
+    {
+        assert(expected > 0);
+        // 参与者多于核心数时，等待者自旋只会占用最后一个到达者需要的 CPU，应直接挂起
+        unsigned cores = std::thread::hardware_concurrency();
+        if (cores > 1 && participants_ <= cores)
+            spin_limit_ = 256;
+        // 按层构建：第 0 层是叶子，每层的节点按 fan_in 个一组挂到下一层
+        std::vector<std::size_t> counts, parents;
+        std::size_t level_begin = 0, level_size = (participants_ + fan_in - 1) / fan_in;
+        for (std::size_t i = 0; i < level_size; ++i)
+            counts.push_back(std::min(fan_in, participants_ - i * fan_in));
+        parents.resize(counts.size(), npos);
+        while (level_size > 1)
+        {
+            std::size_t next_begin = level_begin + level_size, next_size = (level_size + fan_in - 1) / fan_in;
+            for (std::size_t i = 0; i < next_size; ++i)
+                counts.push_back(std::min(fan_in, level_size - i * fan_in));
+            parents.resize(counts.size(), npos);
+            for (std::size_t i = 0; i < level_size; ++i)
+                parents[level_begin + i] = next_begin + i / fan_in;
+            level_begin = next_begin;
+            level_size = next_size;
+        }
+        nodes_ = std::make_unique<node[]>(counts.size());
+        for (std::size_t i = 0; i < counts.size(); ++i)
+        {
+            nodes_[i].expected.store(counts[i], std::memory_order_relaxed);
+            nodes_[i].parent = parents[i];
+        }
+    }
+    tree_barrier(const tree_barrier &) = delete;
+    tree_barrier &operator=(const tree_barrier &) = delete;
+
+    void arrive_and_wait()
+    {
+        std::uint64_t phase = phase_.load(std::memory_order_acquire);
+        if (!arrive(false))
+            wait(phase);
+    }
+
+    void arrive_and_drop() { arrive(true); }
+
+private:
+    std::size_t leaf_of_this_thread()
+    {
+        // 线程退出时这里的记录随之销毁；同一线程先后使用很多屏障时记录会累积，阶段循环中屏障数量很少，线性查找即可
+        thread_local std::vector<std::pair<std::uint64_t, std::size_t>> slots;
+        for (auto &[id, slot] : slots)
+            if (id == id_)
+                return slot / fan_in;
+        std::size_t slot = next_slot_.fetch_add(1, std::memory_order_relaxed);
+        assert(slot < participants_ && "到达屏障的线程数超过了构造时指定的数量");
+        slots.emplace_back(id_, slot);
+        return slot / fan_in;
+    }
+
+    // 返回 true 表示本线程完成了这一阶段
+    bool arrive(bool drop)
+    {
+        std::uint64_t phase = phase_.load(std::memory_order_relaxed);
+        std::size_t i = leaf_of_this_thread();
+        for (;;)
+        {
+            node &n = nodes_[i];
+            // 期待计数只会被本阶段最后到达的线程修改，必须在自己的到达操作之前读取，否则可能读到刚扣除过退出数量的新值
+            std::size_t expected = n.expected.load(std::memory_order_relaxed);
+            if (drop)
+                n.drops.fetch_add(1, std::memory_order_relaxed);
+            if (n.count.fetch_add(1, std::memory_order_acq_rel) + 1 != expected)
+                return false;
+
+            n.count.store(0, std::memory_order_relaxed);
+            std::size_t dropped = n.drops.exchange(0, std::memory_order_relaxed);
+            drop = dropped != 0 && n.expected.fetch_sub(dropped, std::memory_order_relaxed) == dropped;
+            if (n.parent == npos)
+                break;
+            i = n.parent;
+        }
+        completion_();
+        phase_.store(phase + 1, std::memory_order_release);
+        phase_.notify_all();
+        return true;
+    }
+
+    void wait(std::uint64_t phase) const
+    {
+        for (int i = 0; i < spin_limit_; ++i)
+        {
+            if (phase_.load(std::memory_order_acquire) != phase)
+                return;
+            cpu_relax();
+        }
+        while (phase_.load(std::memory_order_acquire) == phase)
+            phase_.wait(phase, std::memory_order_acquire);
+    }
+};
+
+// VERSION_15 的场景：线程 2 在第 3 轮退出，完成函数检查每一轮的到达数是否等于活跃线程数
+std::atomic_int arrived{0};
+std::atomic_int active_threads{4};
+
+void drop_demo()
+{
+    tree_barrier barrier{4, [n = 1]() mutable noexcept
+                         {
+                             std::cout << "\t第" << n++ << "轮结束，到达 " << arrived << " 个，活跃线程数: " << active_threads << '\n';
+                             arrived = 0;
+                         }};
+    std::vector<std::jthread> threads;
+    for (int id = 1; id <= 4; ++id)
+    {
+        threads.emplace_back([&barrier, id]
+                             {
+            for (int i = 1; i <= 5; ++i)
+            {
+                ++arrived;
+                if (i == 3 && id == 2)
+                {
+                    --active_threads;
+                    barrier.arrive_and_drop();
+                    return;
+                }
+                barrier.arrive_and_wait();
+            } });
+    }
+}
+
+// 每个线程执行 episodes 次 arrive_and_wait，完成函数检查本轮所有线程的工作都已可见
+struct episode_check
+{
+    const std::vector<std::size_t> *work;
+    std::size_t *checked;
+    bool *ok;
+
+    void operator()() noexcept
+    {
+        ++*checked;
+        for (auto w : *work)
+            *ok = *ok && w == *checked;
+    }
+};
+
+template <typename Barrier>
+double episodes_per_second(std::size_t num_threads, std::size_t episodes)
+{
+    std::vector<std::size_t> work(num_threads);
+    std::size_t checked = 0;
+    bool ok = true;
+    Barrier barrier{static_cast<std::ptrdiff_t>(num_threads), episode_check{&work, &checked, &ok}};
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t t = 0; t < num_threads; ++t)
+            threads.emplace_back([&, t]
+                                 {
+                for (std::size_t e = 0; e < episodes; ++e)
+                {
+                    ++work[t];
+                    barrier.arrive_and_wait();
+                } });
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!ok || checked != episodes)
+        std::cout << "错误：阶段完成时存在未到达的线程\n";
+    return episodes / seconds;
+}
+
+int main()
+{
+    drop_demo();
+
+    constexpr std::size_t episodes = 5000;
+    std::size_t max_threads = std::max(16u, std::thread::hardware_concurrency());
+    std::cout << "线程数\tstd::barrier (轮/秒)\ttree_barrier (轮/秒)\n";
+    for (std::size_t n = 1; n <= max_threads; n *= 2)
+    {
+        double a = episodes_per_second<std::barrier<episode_check>>(n, episodes);
+        double b = episodes_per_second<tree_barrier<episode_check>>(n, episodes);
+        std::cout << n << '\t' << static_cast<long>(a) << "\t\t\t" << static_cast<long>(b) << '\n';
+    }
+}
+
+#elif defined(VERSION_20)
+// 准入控制：并发上限 + 有界等待队列 + 截止时间 + 过载丢弃
+/*
+VERSION_12 的 handle_request 用 counting_semaphore<3> 限制并发，但多出来的请求会无限期阻塞，既没有超时也没有顺序可言。
+过载时这样的排队只会让每个请求都变慢，最后全部超时。admission_controller 在信号量的基础上补上这些：
+1: 并发上限按 AIMD 调整：请求处理延迟低于目标时，每完成 limit 个请求上限加 1（只在上限被用到一半以上时增长，否则空闲时会无限上涨）；
+   超过目标时乘以 backoff（同一个目标时间内至多一次）
+2: 拿不到名额的请求进入有界队列，每个等待者在自己的 binary_semaphore 上 try_acquire_for 等待，超过截止时间即返回 timed_out
+3: CoDel：统计每个 interval 内队首（最老）等待者排队时间的最小值，若它仍超过 queue_target，说明队列是常驻的而不是突发的，此时进入过载状态：
+   - 排队时间上限从 interval 缩短到 queue_target，等不到的请求被丢弃（shed）
+   - 队列改为 LIFO：新请求更可能还在调用方的超时之内，先服务它们；队列满时丢弃最老的请求，而不是拒绝新请求
+   LIFO 下被服务的请求几乎不排队，如果按出队请求的排队时间判断会立刻退出过载状态，所以看的是队首的等待时间，并且直到队列排空才退出过载
+4: 对外暴露 admitted / queued / rejected / shed / timed_out 计数以及当前上限
+*/
+
+class admission_controller
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct options
+    {
+        std::size_t initial_limit = 8;
+        std::size_t min_limit = 1;
+        std::size_t max_limit = 256;
+        std::size_t max_queue = 64;
+        clock::duration queue_target = 5ms;  // CoDel 的目标排队时间
+        clock::duration interval = 100ms;    // CoDel 的统计窗口，也是非过载状态下的最长排队时间
+        clock::duration latency_target = 50ms; // AIMD 的目标处理延迟
+        double backoff = 0.9;
+    };
+
+    enum class outcome
+    {
+        admitted,
+        rejected,  // 队列已满
+        timed_out, // 到达调用方的截止时间
+        shed,      // 被 CoDel 丢弃
+    };
+
+    struct metrics
+    {
+        std::size_t admitted = 0;
+        std::size_t queued = 0;
+        std::size_t rejected = 0;
+        std::size_t shed = 0;
+        std::size_t timed_out = 0;
+        std::size_t limit = 0;
+        std::size_t in_flight = 0;
+        std::size_t queue_length = 0;
+        bool overloaded = false;
+    };
+
+    // 持有一个并发名额，析构时归还，归还时以持有时长作为本次请求的处理延迟
+    class permit
+    {
+        admission_controller *owner_ = nullptr;
+        outcome outcome_ = outcome::rejected;
+        clock::time_point start_;
+
+        friend class admission_controller;
+        permit(admission_controller *owner, outcome o) : owner_(owner), outcome_(o), start_(clock::now()) {}
+
+    public:
+        permit(permit &&other) noexcept : owner_(std::exchange(other.owner_, nullptr)), outcome_(other.outcome_), start_(other.start_) {}
+        permit &operator=(permit &&other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                owner_ = std::exchange(other.owner_, nullptr);
+                outcome_ = other.outcome_;
+                start_ = other.start_;
+            }
+            return *this;
+        }
+        ~permit() { release(); }
+
+        outcome result() const noexcept { return outcome_; }
+        explicit operator bool() const noexcept { return outcome_ == outcome::admitted; }
+
+        void release() noexcept
+        {
+            if (auto owner = std::exchange(owner_, nullptr))
+                owner->release(clock::now() - start_);
+        }
+    };
+
+    admission_controller() : admission_controller(options{}) {}
+    explicit admission_controller(const options &opts)
+        : opts_(opts), limit_(std::clamp(opts.initial_limit, opts.min_limit, opts.max_limit)), interval_end_(clock::now() + opts.interval) {}
+    admission_controller(const admission_controller &) = delete;
+    admission_controller &operator=(const admission_controller &) = delete;
+
+    // timeout 是调用方愿意为排队付出的最长时间
+    permit acquire(clock::duration timeout)
+    {
+        std::unique_lock<std::mutex> lk{m_};
+        auto now = clock::now();
+        if (in_flight_ < limit_ && queue_.empty())
+        {
+            ++in_flight_;
+            ++metrics_.admitted;
+            sample_queue(now);
+            return permit{this, outcome::admitted};
+        }
+        if (queue_.size() >= opts_.max_queue)
+        {
+            if (!overloaded_)
+            {
+                ++metrics_.rejected;
+                return permit{nullptr, outcome::rejected};
+            }
+            waiter *oldest = queue_.front();
+            queue_.pop_front();
+            oldest->result = outcome::shed;
+            oldest->ready.release();
+        }
+
+        waiter w{now};
+        queue_.push_back(&w);
+        ++metrics_.queued;
+        sample_queue(now);
+        auto budget = overloaded_ ? opts_.queue_target : opts_.interval;
+        auto expired = timeout <= budget ? outcome::timed_out : outcome::shed;
+        lk.unlock();
+
+        bool signaled = w.ready.try_acquire_for(std::min(timeout, budget));
+
+        // 即使已被唤醒也要重新加锁：唤醒方在持锁时调用 release()，拿到锁才能保证它不再访问 w
+        lk.lock();
+        if (!signaled && w.result == outcome::rejected)
+        {
+            queue_.erase(std::find(queue_.begin(), queue_.end(), &w));
+            w.result = expired;
+        }
+        switch (w.result)
+        {
+        case outcome::admitted:
+            return permit{this, outcome::admitted};
+        case outcome::timed_out:
+            ++metrics_.timed_out;
+            break;
+        default:
+            ++metrics_.shed;
+            break;
+        }
+        return permit{nullptr, w.result};
+    }
+
+    metrics snapshot() const
+    {
+        std::lock_guard<std::mutex> lk{m_};
+        metrics m = metrics_;
+        m.limit = limit_;
+        m.in_flight = in_flight_;
+        m.queue_length = queue_.size();
+        m.overloaded = overloaded_;
+        return m;
+    }
+
+private:
+    struct waiter
+    {
+        clock::time_point enqueued;
+        std::binary_semaphore ready{0};
+        outcome result = outcome::rejected; // rejected 表示仍在队列中
+    };
+
+    options opts_;
+    mutable std::mutex m_;
+    std::deque<waiter *> queue_;
+    std::size_t limit_;
+    std::size_t in_flight_ = 0;
+    std::size_t successes_ = 0;
+    clock::time_point last_decrease_{};
+    bool overloaded_ = false;
+    clock::duration interval_min_ = clock::duration::max();
+    clock::time_point interval_end_;
+    metrics metrics_;
+
+    void sample_queue(clock::time_point now)
+    {
+        auto sojourn = queue_.empty() ? clock::duration::zero() : now - queue_.front()->enqueued;
+        interval_min_ = std::min(interval_min_, sojourn);
+        if (now >= interval_end_)
+        {
+            overloaded_ = overloaded_ ? interval_min_ > clock::duration::zero() : interval_min_ > opts_.queue_target;
+            interval_min_ = clock::duration::max();
+            interval_end_ = now + opts_.interval;
+        }
+    }
+
+    void release(clock::duration latency)
+    {
+        std::lock_guard<std::mutex> lk{m_};
+        --in_flight_;
+        auto now = clock::now();
+        if (latency > opts_.latency_target)
+        {
+            successes_ = 0;
+            if (now - last_decrease_ >= opts_.latency_target)
+            {
+                limit_ = std::max(opts_.min_limit, static_cast<std::size_t>(limit_ * opts_.backoff));
+                last_decrease_ = now;
+            }
+        }
+        else if ((in_flight_ + 1) * 2 >= limit_ && ++successes_ >= limit_)
+        {
+            successes_ = 0;
+            limit_ = std::min(opts_.max_limit, limit_ + 1);
+        }
+
+        while (in_flight_ < limit_ && !queue_.empty())
+        {
+            waiter *w;
+            if (overloaded_)
+            {
+                w = queue_.back();
+                queue_.pop_back();
+            }
+            else
+            {
+                w = queue_.front();
+                queue_.pop_front();
+            }
+            ++in_flight_;
+            ++metrics_.admitted;
+            w->result = outcome::admitted;
+            w->ready.release();
+        }
+        sample_queue(now);
+    }
+};
+
+// 模拟后端：并发越高处理越慢，超过 4 个并发后延迟按并发数线性增长
+std::atomic_int backend_load{0};
+
+void backend_call()
+{
+    int load = ++backend_load;
+    std::this_thread::sleep_for(10ms * std::max(1, load / 4));
+    --backend_load;
+}
+
+admission_controller controller{admission_controller::options{
+    .initial_limit = 4,
+    .max_queue = 32,
+    .latency_target = 30ms,
+}};
+
+void handle_request(std::stop_token stop, std::chrono::milliseconds think_time)
+{
+    while (!stop.stop_requested())
+    {
+        if (auto p = controller.acquire(100ms))
+            backend_call();
+        else
+            std::this_thread::sleep_for(10ms); // 被拒绝后退避，而不是立即重试
+        std::this_thread::sleep_for(think_time);
+    }
+}
+
+void run_clients(const char *name, int clients, std::chrono::milliseconds think_time, std::chrono::milliseconds duration)
+{
+    auto before = controller.snapshot();
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < clients; ++i)
+            threads.emplace_back(handle_request, think_time);
+        std::this_thread::sleep_for(duration);
+    }
+    auto m = controller.snapshot();
+    std::cout << name << "（" << clients << " 个客户端）: 准入 " << m.admitted - before.admitted
+              << "，排队 " << m.queued - before.queued
+              << "，拒绝 " << m.rejected - before.rejected
+              << "，丢弃 " << m.shed - before.shed
+              << "，超时 " << m.timed_out - before.timed_out
+              << "，当前上限 " << m.limit << std::boolalpha << "，过载: " << m.overloaded << '\n';
+}
+
+int main()
+{
+    run_clients("正常负载", 8, 20ms, 1s);
+    run_clients("过载", 128, 0ms, 2s);
+    run_clients("恢复", 8, 20ms, 1s);
+}
+
+#elif defined(VERSION_21)
+// 速率限制：令牌桶、滑动窗口与按键分片的限流器
+/*
+信号量（VERSION_12、VERSION_20）限制的是同时进行的请求数，速率限制限制的是单位时间内的请求数，两者通常一起使用。
+这里的限流器在高并发下不加锁，状态都压缩在一个 64 位原子变量里，通过 CAS 更新：
+1: token_bucket：以 GCRA 的形式实现令牌桶。不单独保存令牌数，而是保存“理论到达时间” tat（相对于 steady_clock 的纳秒数）：
+   桶中的令牌数 = (now + burst * interval - max(tat, now)) / interval，取走 n 个令牌就是把 tat 向后推 n * interval。
+   补充令牌不需要后台线程，也不需要单独的时间戳，每次获取时由 CAS 根据当前时间一并完成
+   阻塞获取采用预约：直接把 tat 推到未来，然后睡到属于自己的时刻，请求按到达顺序得到令牌，不会反复重试
+2: sliding_window_limiter：滑动窗口计数，估计值 = 上一窗口计数 * 上一窗口仍在滑动窗口内的比例 + 当前窗口计数，
+   窗口编号与两个计数打包在一起（24 + 20 + 20 位），因此单个窗口内的上限不能超过 2^20 - 1；
+   窗口编号按模 2^24 比较，空闲恰好接近 2^24 个窗口的整数倍时可能沿用旧计数，结果只会偏保守，且至多持续两个窗口
+3: keyed_limiter：按键（用户、租户、接口）各自限流，键空间分成若干分片，每个分片一个 shared_mutex，
+   已存在的键只加共享锁，限流器本身仍是无锁的；长期空闲的键可以用 evict_if 清理
+每种限流器都提供非阻塞的 try_acquire、带超时的 try_acquire_for 以及阻塞的 acquire
+*/
+
+class token_bucket
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    token_bucket(double rate_per_second, std::size_t burst)
+        : interval_(std::max<std::int64_t>(1, std::llround(1e9 / rate_per_second))),
+          burst_span_(interval_ * static_cast<std::int64_t>(burst)), origin_(clock::now())
+    {
+        assert(rate_per_second > 0 && burst > 0);
+    }
+
+    bool try_acquire(std::size_t n = 1) { return reserve(n, 0) == 0; }
+
+    // 超时之内能等到令牌时预约并等待，否则不占用令牌立即返回 false
+    template <typename Rep, typename Period>
+    bool try_acquire_for(std::size_t n, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        auto wait = reserve(n, std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count());
+        if (wait < 0)
+            return false;
+        if (wait > 0)
+            std::this_thread::sleep_for(std::chrono::nanoseconds{wait});
+        return true;
+    }
+
+    void acquire(std::size_t n = 1)
+    {
+        auto wait = reserve(n, std::numeric_limits<std::int64_t>::max());
+        if (wait > 0)
+            std::this_thread::sleep_for(std::chrono::nanoseconds{wait});
+    }
+
+    double available() const
+    {
+        auto now = elapsed();
+        return static_cast<double>(now + burst_span_ - std::max(tat_.load(std::memory_order_relaxed), now)) / interval_;
+    }
+
+    bool idle() const { return tat_.load(std::memory_order_relaxed) <= elapsed(); }
+
+private:
+    std::int64_t interval_;   // 每个令牌的纳秒数
+    std::int64_t burst_span_; // 桶容量对应的纳秒数
+    clock::time_point origin_;
+    std::atomic<std::int64_t> tat_{0}; // 初始为 0：桶是满的
+
+    std::int64_t elapsed() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - origin_).count();
+    }
+
+    // 返回需要等待的纳秒数，需要等待的时间超过 max_wait 时返回 -1 且不修改状态
+    std::int64_t reserve(std::size_t n, std::int64_t max_wait)
+    {
+        const std::int64_t cost = interval_ * static_cast<std::int64_t>(n);
+        assert(cost <= burst_span_ && "一次获取的令牌数不能超过桶容量");
+        const auto now = elapsed();
+        auto tat = tat_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto new_tat = std::max(tat, now) + cost;
+            auto wait = new_tat - burst_span_ - now;
+            if (wait > max_wait)
+                return -1;
+            if (tat_.compare_exchange_weak(tat, new_tat, std::memory_order_relaxed))
+                return std::max<std::int64_t>(wait, 0);
+        }
+    }
+};
+
+class sliding_window_limiter
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    sliding_window_limiter(std::size_t limit, clock::duration window)
+        : limit_(limit), window_(std::chrono::duration_cast<std::chrono::nanoseconds>(window).count()), origin_(clock::now())
+    {
+        assert(limit > 0 && limit <= count_mask && window_ > 0);
+    }
+
+    bool try_acquire(std::size_t n = 1) { return attempt(n) == 0; }
+
+    template <typename Rep, typename Period>
+    bool try_acquire_for(std::size_t n, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        auto deadline = clock::now() + timeout;
+        for (std::int64_t wait; (wait = attempt(n)) != 0;)
+        {
+            auto wake = clock::now() + std::chrono::nanoseconds{wait};
+            if (wake > deadline)
+                return false;
+            std::this_thread::sleep_until(wake);
+        }
+        return true;
+    }
+
+    void acquire(std::size_t n = 1)
+    {
+        for (std::int64_t wait; (wait = attempt(n)) != 0;)
+            std::this_thread::sleep_for(std::chrono::nanoseconds{wait});
+    }
+
+    bool idle() const
+    {
+        auto [window, prev, cur] = unpack(state_.load(std::memory_order_relaxed));
+        auto delta = (elapsed() / window_ - window) & window_mask;
+        return (delta >= 2 && !behind(delta)) || (delta == 1 && cur == 0) || (prev == 0 && cur == 0);
+    }
+
+private:
+    static constexpr std::uint64_t count_bits = 20, count_mask = (1u << count_bits) - 1;
+    static constexpr std::uint64_t window_mask = (1u << 24) - 1;
+
+    std::size_t limit_;
+    std::int64_t window_;
+    clock::time_point origin_;
+    std::atomic<std::uint64_t> state_{0}; // [窗口编号:24][上一窗口计数:20][当前窗口计数:20]
+
+    struct unpacked
+    {
+        std::uint64_t window, prev, cur;
+    };
+    static unpacked unpack(std::uint64_t s) { return {s >> (2 * count_bits), (s >> count_bits) & count_mask, s & count_mask}; }
+    static std::uint64_t pack(std::uint64_t window, std::uint64_t prev, std::uint64_t cur)
+    {
+        return ((window & window_mask) << (2 * count_bits)) | (prev << count_bits) | cur;
+    }
+
+    std::int64_t elapsed() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - origin_).count();
+    }
+
+    // 差值按模 2^24 计算：只有 -1、-2 表示本线程的时间比另一个线程已经写入的窗口稍旧，其余都是向前推进
+    // 不能把后半段都当作“更旧”，否则空闲超过 2^23 个窗口之后，每次调用都会一直重试到编号回绕
+    static bool behind(std::uint64_t delta) noexcept { return delta >= window_mask - 1; }
+
+    // 成功返回 0，否则返回建议的等待纳秒数
+    std::int64_t attempt(std::size_t n)
+    {
+        assert(n <= limit_);
+        auto s = state_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            const auto now = elapsed();
+            std::uint64_t window = now / window_;
+            const std::int64_t offset = now % window_;
+            auto [stored, prev, cur] = unpack(s);
+            auto delta = (window - stored) & window_mask;
+            if (behind(delta))
+            {
+                // 计入已经写入的较新窗口，不重试
+                window = stored;
+                delta = 0;
+            }
+            if (delta == 1)
+                prev = cur, cur = 0;
+            else if (delta >= 2)
+                prev = cur = 0;
+
+            double weight = 1.0 - static_cast<double>(offset) / window_;
+            double estimate = prev * weight + cur;
+            if (estimate + n > limit_)
+            {
+                // 上一窗口的计数随时间线性衰减，估算它衰减到足够小的时刻，最迟等到下一个窗口开始
+                std::int64_t until_next = window_ - offset;
+                if (prev == 0)
+                    return until_next;
+                double excess = estimate + n - limit_;
+                return std::clamp<std::int64_t>(std::llround(excess / prev * window_), 1, until_next);
+            }
+            if (state_.compare_exchange_weak(s, pack(window, prev, cur + n), std::memory_order_relaxed))
+                return 0;
+        }
+    }
+};
+
+template <typename Key, typename Limiter, typename Hash = std::hash<Key>>
+class keyed_limiter
+{
+    struct alignas(64) shard
+    {
+        std::shared_mutex m;
+        std::unordered_map<Key, std::shared_ptr<Limiter>, Hash> limiters;
+    };
+
+    std::function<std::shared_ptr<Limiter>(const Key &)> factory_;
+    std::vector<shard> shards_;
+    Hash hash_;
+
+    shard &shard_for(const Key &key) { return shards_[hash_(key) % shards_.size()]; }
+
+    // 命中时只在共享锁下调用 fn，不复制 shared_ptr，避免热点键上的引用计数争用
+    template <typename F>
+    auto with_limiter(const Key &key, F &&fn)
+    {
+        shard &s = shard_for(key);
+        {
+            std::shared_lock<std::shared_mutex> lk{s.m};
+            if (auto it = s.limiters.find(key); it != s.limiters.end())
+                return fn(it->second);
+        }
+        std::lock_guard<std::shared_mutex> lk{s.m};
+        auto [it, inserted] = s.limiters.try_emplace(key);
+        if (inserted)
+            it->second = factory_(key);
+        return fn(it->second);
+    }
+
+    // 阻塞等待时不能持有分片的锁，持有一份 shared_ptr 防止等待期间被 evict_if 销毁
+    std::shared_ptr<Limiter> find_or_create(const Key &key)
+    {
+        return with_limiter(key, [](const std::shared_ptr<Limiter> &l)
+                            { return l; });
+    }
+
+public:
+    // factory(key) 为新出现的键创建限流器，返回 std::shared_ptr<Limiter>
+    template <typename Factory>
+    explicit keyed_limiter(Factory factory, std::size_t num_shards = 16)
+        : factory_(std::move(factory)), shards_(std::max<std::size_t>(1, num_shards))
+    {
+    }
+
+    bool try_acquire(const Key &key, std::size_t n = 1)
+    {
+        return with_limiter(key, [n](const std::shared_ptr<Limiter> &l)
+                            { return l->try_acquire(n); });
+    }
+
+    template <typename Rep, typename Period>
+    bool try_acquire_for(const Key &key, std::size_t n, const std::chrono::duration<Rep, Period> &timeout)
+    {
+        return find_or_create(key)->try_acquire_for(n, timeout);
+    }
+
+    void acquire(const Key &key, std::size_t n = 1) { find_or_create(key)->acquire(n); }
+
+    // 清理满足条件（通常是 idle()）的限流器，返回清理的数量
+    template <typename Pred>
+    std::size_t evict_if(Pred pred)
+    {
+        std::size_t erased = 0;
+        for (auto &s : shards_)
+        {
+            std::lock_guard<std::shared_mutex> lk{s.m};
+            erased += std::erase_if(s.limiters, [&](const auto &kv)
+                                    { return pred(std::as_const(*kv.second)); });
+        }
+        return erased;
+    }
+
+    std::size_t size()
+    {
+        std::size_t n = 0;
+        for (auto &s : shards_)
+        {
+            std::shared_lock<std::shared_mutex> lk{s.m};
+            n += s.limiters.size();
+        }
+        return n;
+    }
+};
+
+template <typename Limiter>
+std::size_t hammer(Limiter &limiter, int num_threads, std::chrono::milliseconds duration)
+{
+    std::atomic<std::size_t> granted{0};
+    auto deadline = std::chrono::steady_clock::now() + duration;
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < num_threads; ++i)
+            threads.emplace_back([&]
+                                 {
+                while (std::chrono::steady_clock::now() < deadline)
+                {
+                    if (limiter.try_acquire())
+                        granted.fetch_add(1, std::memory_order_relaxed);
+                    else
+                        std::this_thread::yield();
+                } });
+    }
+    return granted;
+}
+
+int main()
+{
+    {
+        // 1000 个/秒，桶容量 50：500ms 内最多 50 + 500 个
+        token_bucket bucket{1000, 50};
+        std::cout << "令牌桶 try_acquire: 500ms 内获得 " << hammer(bucket, 8, 500ms) << " 个（上限 550）\n";
+
+        // 阻塞获取：4 个线程各取 100 个，共 400 个，桶已空，约需 400ms
+        auto start = std::chrono::steady_clock::now();
+        {
+            std::vector<std::jthread> threads;
+            for (int i = 0; i < 4; ++i)
+                threads.emplace_back([&]
+                                     {
+                    for (int j = 0; j < 100; ++j)
+                        bucket.acquire(); });
+        }
+        std::cout << "令牌桶 acquire: 400 个用时 "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << "ms\n";
+        std::cout << std::boolalpha << "等待 10ms 能否获得 50 个: " << bucket.try_acquire_for(50, 10ms)
+                  << "，等待 100ms: " << bucket.try_acquire_for(50, 100ms) << '\n';
+    }
+    {
+        // 每 100ms 最多 200 个：500ms 内约 1000 个
+        sliding_window_limiter window{200, 100ms};
+        std::cout << "滑动窗口 try_acquire: 500ms 内获得 " << hammer(window, 8, 500ms) << " 个（约 1000）\n";
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 300; ++i)
+            window.acquire();
+        std::cout << "滑动窗口 acquire: 300 个用时 "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << "ms\n";
+    }
+    {
+        // 100 个用户，每个用户 100 个/秒，容量 10：300ms 内每个用户最多 40 个
+        keyed_limiter<int, token_bucket> per_user{[](int)
+                                                  { return std::make_shared<token_bucket>(100, 10); }};
+        std::vector<std::atomic<std::size_t>> granted(100);
+        auto deadline = std::chrono::steady_clock::now() + 300ms;
+        {
+            std::vector<std::jthread> threads;
+            for (int t = 0; t < 8; ++t)
+                threads.emplace_back([&, t]
+                                     {
+                    std::mt19937 gen{static_cast<unsigned>(t)};
+                    std::uniform_int_distribution<int> user{0, 99};
+                    while (std::chrono::steady_clock::now() < deadline)
+                    {
+                        int u = user(gen);
+                        if (per_user.try_acquire(u))
+                            granted[u].fetch_add(1, std::memory_order_relaxed);
+                    } });
+        }
+        std::size_t max_granted = 0, total = 0;
+        for (auto &g : granted)
+            max_granted = std::max<std::size_t>(max_granted, g), total += g;
+        std::cout << "按用户限流: " << per_user.size() << " 个用户共获得 " << total << " 个，单个用户最多 " << max_granted << " 个（上限 40）\n";
+
+        std::this_thread::sleep_for(150ms);
+        std::cout << "清理空闲用户 " << per_user.evict_if([](const token_bucket &b)
+                                                          { return b.idle(); })
+                  << " 个\n";
+    }
+}
+
+#elif defined(VERSION_22)
+// single_flight：基于 shared_future 合并相同键的并发请求
+/*
+VERSION_8 中多个线程各自持有 shared_future 的副本，等待同一个 fetch_data() 的结果。把这个模式做成组件：
+1: 对同一个键的并发调用只执行一次计算，第一个调用者（leader）在自己的线程中执行，其余调用者拿到同一个 shared_future 等待结果，
+   避免慢后端在缓存失效或冷启动时被同一份请求打满（惊群）
+2: 计算完成后按策略处理：release 立即移除，之后的调用重新计算；cache 保留结果，直到 forget() 被调用
+   计算抛出异常时所有等待者都会得到这个异常，且异常结果从不缓存，下一次调用会重试
+3: 每个 flight 有唯一编号，leader 完成后只移除自己创建的条目，不会误删 forget() 之后新开始的 flight
+注意 fn 中不能再以同一个键调用同一个 single_flight，否则会等待自己而死锁
+*/
+
+enum class flight_policy
+{
+    release, // 完成后移除，只合并同时进行的请求
+    cache,   // 完成后保留成功的结果
+};
+
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class single_flight
+{
+public:
+    struct call_result
+    {
+        std::shared_future<Value> future;
+        bool leader; // 本次调用是否执行了计算
+    };
+
+    explicit single_flight(flight_policy policy = flight_policy::release) : policy_(policy) {}
+    single_flight(const single_flight &) = delete;
+    single_flight &operator=(const single_flight &) = delete;
+
+    // 返回时计算已经完成（leader）或者正在进行（其它调用者），结果通过 future 获取
+    template <typename F>
+    call_result do_call(const Key &key, F &&fn)
+    {
+        std::promise<Value> promise;
+        std::shared_future<Value> future = promise.get_future().share();
+        std::uint64_t id;
+        {
+            std::lock_guard<std::mutex> lk{m_};
+            if (auto it = flights_.find(key); it != flights_.end())
+                return {it->second.future, false};
+            id = ++next_id_;
+            flights_.emplace(key, flight{future, id});
+        }
+
+        bool failed = false;
+        try
+        {
+            promise.set_value(std::invoke(std::forward<F>(fn)));
+        }
+        catch (...)
+        {
+            failed = true;
+            promise.set_exception(std::current_exception());
+        }
+
+        if (failed || policy_ == flight_policy::release)
+        {
+            std::lock_guard<std::mutex> lk{m_};
+            if (auto it = flights_.find(key); it != flights_.end() && it->second.id == id)
+                flights_.erase(it);
+        }
+        return {std::move(future), true};
+    }
+
+    Value call(const Key &key, const std::function<Value()> &fn) { return do_call(key, fn).future.get(); }
+
+    // 移除键对应的条目，正在进行的计算不受影响，之后的调用会开始新的计算
+    bool forget(const Key &key)
+    {
+        std::lock_guard<std::mutex> lk{m_};
+        return flights_.erase(key) != 0;
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard<std::mutex> lk{m_};
+        return flights_.size();
+    }
+
+private:
+    struct flight
+    {
+        std::shared_future<Value> future;
+        std::uint64_t id;
+    };
+
+    flight_policy policy_;
+    mutable std::mutex m_;
+    std::unordered_map<Key, flight, Hash> flights_;
+    std::uint64_t next_id_ = 0;
+};
+
+// 后端桩函数：每次调用耗时 200ms，并记录各个键被实际请求的次数
+std::mutex backend_mutex;
+std::map<std::string, int> backend_calls;
+
+std::string slow_fetch(const std::string &key)
+{
+    {
+        std::lock_guard<std::mutex> lk{backend_mutex};
+        ++backend_calls[key];
+    }
+    std::this_thread::sleep_for(200ms);
+    if (key == "bad")
+        throw std::runtime_error("后端错误: " + key);
+    return "数据(" + key + ")";
+}
+
+void burst(single_flight<std::string, std::string> &group, const std::vector<std::string> &keys, int clients)
+{
+    std::atomic_int leaders{0}, errors{0};
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < clients; ++i)
+            threads.emplace_back([&, i]
+                                 {
+                const std::string &key = keys[i % keys.size()];
+                auto [future, leader] = group.do_call(key, [&]
+                                                      { return slow_fetch(key); });
+                leaders += leader;
+                try
+                {
+                    future.get();
+                }
+                catch (const std::exception &)
+                {
+                    ++errors;
+                } });
+    }
+    std::lock_guard<std::mutex> lk{backend_mutex};
+    std::cout << "  " << clients << " 个请求，leader " << leaders << " 个，失败 " << errors << " 个，后端调用:";
+    for (auto &[key, n] : backend_calls)
+        std::cout << ' ' << key << '=' << n;
+    std::cout << '\n';
+    backend_calls.clear();
+}
+
+int main()
+{
+    std::vector<std::string> keys{"a", "b", "c", "bad"};
+    for (auto policy : {flight_policy::release, flight_policy::cache})
+    {
+        single_flight<std::string, std::string> group{policy};
+        std::cout << (policy == flight_policy::release ? "release" : "cache") << " 策略\n";
+        burst(group, keys, 32); // 每个键只请求一次后端
+        burst(group, keys, 32); // release：再次请求后端；cache：只有失败的 bad 会重试
+        std::cout << "  剩余条目 " << group.size() << '\n';
+    }
+}
+
 #endif
\ No newline at end of file
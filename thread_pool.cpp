@@ -1,19 +1,43 @@
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <bit>
 #include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <execution>
 #include <functional>
 #include <future>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <memory_resource>
 #include <memory>
 #include <mutex>
+#include <numeric>
+#include <optional>
 #include <queue>
+#include <random>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
 #include <syncstream>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 using namespace std::chrono_literals;
 
 // qt、boost 库的多线程见 md
 
+#define VERSION_6
+
 inline std::size_t default_thread_pool_size() noexcept
 {
     std::size_t num_threads = std::thread::hardware_concurrency();
@@ -21,17 +45,429 @@ inline std::size_t default_thread_pool_size() noexcept
     return num_threads;
 }
 
+// 线程本地缓存的 slab 分配器：小对象按 2 的幂分级（16 ~ 1024 字节）
+/*
+Thread_Pool::submit、threadsafe_queue::pop 中的 make_shared、每个 std::promise 的共享状态，每次调用都要分配内存
+1: 每个线程为每个大小级别维护一个空闲链表，分配与释放只操作本线程的链表，不加锁
+2: 本线程的链表为空时，从全局池中取一批；全局池也为空时，向上游申请一整块（chunk_size）切分
+3: 一个线程释放别的线程分配的内存（生产者-消费者）会让它的链表越来越长，超过 2 * batch_size 时成批归还全局池，供其它线程取用
+4: 线程退出时把缓存全部归还全局池；大于 1024 字节或对齐要求更高的分配直接转给上游
+内存块只在 slab_resource 析构时整体归还上游；线程只持有全局池的 weak_ptr，slab_resource 先于线程销毁也是安全的
+它是一个 std::pmr::memory_resource，配合 std::pmr::polymorphic_allocator 可以用于容器、std::allocate_shared 与 std::promise
+*/
+class slab_resource : public std::pmr::memory_resource
+{
+public:
+    static constexpr std::size_t min_block = 16;
+    static constexpr std::size_t max_block = 1024;
+    static constexpr std::size_t class_count = 7; // 16, 32, ..., 1024
+    static constexpr std::size_t batch_size = 32;
+    static constexpr std::size_t chunk_size = 64 * 1024;
+
+    explicit slab_resource(std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+        : pool_(std::make_shared<global_pool>(upstream)) {}
+    slab_resource(const slab_resource &) = delete;
+    slab_resource &operator=(const slab_resource &) = delete;
+
+private:
+    struct free_block
+    {
+        free_block *next;
+    };
+
+    struct block_list
+    {
+        free_block *head = nullptr;
+        std::size_t count = 0;
+
+        void push(void *p) noexcept
+        {
+            head = ::new (p) free_block{head};
+            ++count;
+        }
+        void *pop() noexcept
+        {
+            free_block *block = head;
+            head = block->next;
+            --count;
+            return block;
+        }
+        // 从头部取下 n 个
+        block_list split(std::size_t n) noexcept
+        {
+            free_block *tail = head;
+            for (std::size_t i = 1; i < n; ++i)
+                tail = tail->next;
+            block_list front{head, n};
+            head = std::exchange(tail->next, nullptr);
+            count -= n;
+            return front;
+        }
+    };
+
+    struct global_pool
+    {
+        std::pmr::memory_resource *upstream;
+        std::mutex m;
+        std::array<std::vector<block_list>, class_count> batches;
+        std::vector<void *> chunks;
+
+        explicit global_pool(std::pmr::memory_resource *u) : upstream(u) {}
+        ~global_pool()
+        {
+            for (void *chunk : chunks)
+                upstream->deallocate(chunk, chunk_size, max_block);
+        }
+
+        block_list take(std::size_t cls)
+        {
+            std::lock_guard<std::mutex> lock{m};
+            if (!batches[cls].empty())
+            {
+                block_list list = batches[cls].back();
+                batches[cls].pop_back();
+                return list;
+            }
+            chunks.reserve(chunks.size() + 1);
+            auto *chunk = static_cast<std::byte *>(upstream->allocate(chunk_size, max_block));
+            chunks.push_back(chunk);
+            // 块按 max_block 对齐，切出的每个块都按自己的大小对齐
+            block_list list;
+            const std::size_t block = min_block << cls;
+            for (std::size_t offset = chunk_size; offset >= block; offset -= block)
+                list.push(chunk + offset - block);
+            return list;
+        }
+
+        void give_back(std::size_t cls, block_list list)
+        {
+            std::lock_guard<std::mutex> lock{m};
+            batches[cls].push_back(list);
+        }
+    };
+
+    struct thread_cache
+    {
+        std::uint64_t id;
+        std::weak_ptr<global_pool> pool;
+        std::array<block_list, class_count> lists{};
+    };
+
+    struct thread_caches
+    {
+        std::vector<thread_cache> caches;
+        ~thread_caches()
+        {
+            for (auto &cache : caches)
+                if (auto pool = cache.pool.lock())
+                    for (std::size_t cls = 0; cls < class_count; ++cls)
+                        if (cache.lists[cls].count > 0)
+                            pool->give_back(cls, cache.lists[cls]);
+        }
+    };
+
+    static std::uint64_t next_id() noexcept
+    {
+        static std::atomic<std::uint64_t> id{1};
+        return id.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 返回 class_count 表示交给上游
+    static std::size_t size_class(std::size_t bytes, std::size_t alignment) noexcept
+    {
+        std::size_t size = std::max({bytes, alignment, min_block});
+        if (size > max_block)
+            return class_count;
+        return std::bit_width(size - 1) - std::bit_width(min_block - 1);
+    }
+
+    thread_cache &local()
+    {
+        thread_local thread_caches tc;
+        for (auto &cache : tc.caches)
+            if (cache.id == id_)
+                return cache;
+        // 已销毁的 slab_resource 留下的缓存顺便清掉（它们的内存块已归还上游），否则长寿线程的缓存列表只增不减
+        std::erase_if(tc.caches, [](const thread_cache &cache)
+                      { return cache.pool.expired(); });
+        return tc.caches.emplace_back(thread_cache{id_, pool_});
+    }
+
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        std::size_t cls = size_class(bytes, alignment);
+        if (cls == class_count)
+            return pool_->upstream->allocate(bytes, alignment);
+        block_list &list = local().lists[cls];
+        if (!list.head)
+            list = pool_->take(cls);
+        return list.pop();
+    }
+
+    void do_deallocate(void *p, std::size_t bytes, std::size_t alignment) override
+    {
+        std::size_t cls = size_class(bytes, alignment);
+        if (cls == class_count)
+            return pool_->upstream->deallocate(p, bytes, alignment);
+        block_list &list = local().lists[cls];
+        list.push(p);
+        if (list.count >= 2 * batch_size)
+            pool_->give_back(cls, list.split(batch_size));
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+    std::uint64_t id_ = next_id();
+    std::shared_ptr<global_pool> pool_;
+};
+
+// 请求级别的 arena：按指针递增分配，一次 reset() 释放全部
+/*
+一个请求内部会产生大量短命的任务对象与临时缓冲区，逐个 malloc/free 的开销可能超过计算本身
+arena_resource 从上游申请大块内存，分配只是用 CAS 把偏移量向后推，deallocate 什么也不做；请求结束时 reset() 一次性回收
+std::pmr::monotonic_buffer_resource 不是线程安全的，而请求内的任务会在线程池的多个线程中同时分配（例如递归的并行排序），因此不能直接使用
+唯一与 reset() 竞争的是 submit_in 的任务对象（以及它持有的 promise 的共享状态）：set_value() 唤醒请求线程时工作线程还没有销毁它们，
+请求线程 get() 返回后立即 reset() 会把仍在使用的内存交给下一个请求。因此 pool_task 在分配前 pin()、销毁后 unpin()，reset() 只等待这些任务；
+普通分配不计数，请求自己的对象如果活过 reset() 是使用者的错误。任务迟迟不销毁（例如提交后没有等待）时 reset() 会报告一次而不是静默地等待
+reset() 保留最后（最大）的一块，之后的请求不再需要向上游申请
+*/
+class arena_resource : public std::pmr::memory_resource
+{
+public:
+    explicit arena_resource(std::size_t initial_size = 64 * 1024,
+                            std::pmr::memory_resource *upstream = std::pmr::new_delete_resource())
+        : upstream_(upstream), next_size_(initial_size) {}
+    arena_resource(const arena_resource &) = delete;
+    arena_resource &operator=(const arena_resource &) = delete;
+    ~arena_resource()
+    {
+        wait_for_tasks();
+        release(current_.load(std::memory_order_relaxed));
+    }
+
+    void reset()
+    {
+        wait_for_tasks();
+        block *b = current_.load(std::memory_order_relaxed);
+        if (!b)
+            return;
+        release(std::exchange(b->prev, nullptr));
+        b->used.store(0, std::memory_order_relaxed);
+    }
+
+    // 由 pool_task 调用：任务对象及其共享状态销毁之前，reset() 不能回收内存
+    void pin() noexcept { pinned_.fetch_add(1, std::memory_order_relaxed); }
+    // 调用之后不能再访问 arena；release 保证任务对内存的访问先于 reset() 之后的复用
+    void unpin() noexcept { pinned_.fetch_sub(1, std::memory_order_release); }
+
+    // 当前持有的内存总量
+    std::size_t capacity() const noexcept
+    {
+        std::size_t total = 0;
+        for (block *b = current_.load(std::memory_order_acquire); b; b = b->prev)
+            total += b->size;
+        return total;
+    }
+
+private:
+    // 数据紧跟在块头之后
+    struct block
+    {
+        block *prev;
+        std::size_t size;
+        std::atomic<std::size_t> used;
+    };
+    static constexpr std::size_t header = (sizeof(block) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+
+    std::pmr::memory_resource *upstream_;
+    std::atomic<block *> current_{nullptr};
+    std::mutex grow_mutex_;
+    std::size_t next_size_;
+    std::atomic<std::size_t> pinned_{0}; // 尚未销毁的任务数
+
+    static std::byte *data(block *b) noexcept { return reinterpret_cast<std::byte *>(b) + header; }
+
+    void release(block *b) noexcept
+    {
+        while (b)
+        {
+            block *prev = b->prev;
+            std::size_t size = b->size;
+            b->~block();
+            upstream_->deallocate(b, header + size, alignof(std::max_align_t));
+            b = prev;
+        }
+    }
+
+    static void *try_bump(block *b, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        auto base = reinterpret_cast<std::uintptr_t>(data(b));
+        std::size_t used = b->used.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            std::size_t start = ((base + used + alignment - 1) & ~(alignment - 1)) - base;
+            if (start + bytes > b->size)
+                return nullptr;
+            if (b->used.compare_exchange_weak(used, start + bytes, std::memory_order_relaxed))
+                return data(b) + start;
+        }
+    }
+
+    void grow(block *seen, std::size_t bytes, std::size_t alignment)
+    {
+        std::lock_guard<std::mutex> lock{grow_mutex_};
+        if (current_.load(std::memory_order_relaxed) != seen)
+            return; // 其它线程已经换上了新块
+        std::size_t size = std::max(next_size_, bytes + alignment);
+        void *memory = upstream_->allocate(header + size, alignof(std::max_align_t));
+        current_.store(::new (memory) block{seen, size, 0}, std::memory_order_release);
+        next_size_ = size * 2;
+    }
+
+    // unpin() 之后任务不再访问 arena，因此这里只能轮询，不能用 atomic::wait/notify（notify 时 arena 可能已被销毁）
+    // 等待超过 1 秒说明有任务还在队列中或仍在运行，报告一次；此时回收内存会让任务访问已复用的内存，只能继续等
+    void wait_for_tasks() const noexcept
+    {
+        auto deadline = std::chrono::steady_clock::now() + 1s;
+        bool reported = false;
+        while (std::size_t n = pinned_.load(std::memory_order_acquire))
+        {
+            if (!reported && std::chrono::steady_clock::now() > deadline)
+            {
+                reported = true;
+                std::cerr << "arena_resource: reset() 已等待 1 秒，仍有 " << n << " 个任务未销毁（任务是否都已等待？）\n";
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    void *do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        for (;;)
+        {
+            block *b = current_.load(std::memory_order_acquire);
+            if (b)
+                if (void *p = try_bump(b, bytes, alignment))
+                    return p;
+            grow(b, bytes, alignment);
+        }
+    }
+
+    // 内存要到 reset() 才回收
+    void do_deallocate(void *, std::size_t, std::size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+// 请求作用域：离开作用域时回收 arena 中的全部内存
+class arena_scope
+{
+    arena_resource &arena_;
+
+public:
+    explicit arena_scope(arena_resource &arena) noexcept : arena_(arena) {}
+    arena_scope(const arena_scope &) = delete;
+    arena_scope &operator=(const arena_scope &) = delete;
+    ~arena_scope() { arena_.reset(); }
+
+    std::pmr::memory_resource *resource() const noexcept { return &arena_; }
+};
+
+// 线程池中的任务：可调用对象从 memory_resource 中分配，只能移动
+// std::function 要求可复制（放不下 std::promise），捕获 shared_ptr 的 lambda 也放不进它的小对象缓冲区，每次提交都要额外分配
+class pool_task
+{
+    struct base
+    {
+        virtual void run() = 0;
+        virtual void destroy() noexcept = 0;
+
+    protected:
+        ~base() = default;
+    };
+
+    template <typename F>
+    struct holder final : base
+    {
+        F fn;
+        std::pmr::polymorphic_allocator<> alloc;
+        arena_resource *arena; // 从 arena 分配时，销毁之后解除 pin
+
+        holder(F f, std::pmr::polymorphic_allocator<> a, arena_resource *ar) : fn(std::move(f)), alloc(a), arena(ar) {}
+        void run() override { fn(); }
+        void destroy() noexcept override
+        {
+            auto a = alloc;
+            arena_resource *ar = arena;
+            a.delete_object(this);
+            if (ar)
+                ar->unpin();
+        }
+    };
+
+    base *task_ = nullptr;
+
+public:
+    pool_task() noexcept = default;
+    template <typename F>
+    pool_task(std::pmr::memory_resource *resource, F &&fn)
+    {
+        std::pmr::polymorphic_allocator<> alloc{resource};
+        auto *arena = dynamic_cast<arena_resource *>(resource);
+        if (arena)
+            arena->pin();
+        try
+        {
+            task_ = alloc.new_object<holder<std::decay_t<F>>>(std::forward<F>(fn), alloc, arena);
+        }
+        catch (...)
+        {
+            if (arena)
+                arena->unpin();
+            throw;
+        }
+    }
+    pool_task(pool_task &&other) noexcept : task_(std::exchange(other.task_, nullptr)) {}
+    pool_task &operator=(pool_task &&other) noexcept
+    {
+        if (this != &other)
+        {
+            if (task_)
+                task_->destroy();
+            task_ = std::exchange(other.task_, nullptr);
+        }
+        return *this;
+    }
+    ~pool_task()
+    {
+        if (task_)
+            task_->destroy();
+    }
+
+    void operator()() { task_->run(); }
+    explicit operator bool() const noexcept { return task_ != nullptr; }
+};
+
 // 构造函数：初始化线程池并启动线程
 // 析构函数：停止线程池并等待所有线程结束(而非任务结束)
 
 class Thread_Pool
 {
 public:
-    using Task = std::function<void()>;
+    using Task = pool_task;
     Thread_Pool(const Thread_Pool &) = delete;
     Thread_Pool &operator=(const Thread_Pool &) = delete;
 
-    Thread_Pool(std::size_t num_thread = default_thread_pool_size()) : stop_{false}, num_thread_{num_thread}
+    // resource 用于分配任务对象与 future 的共享状态，必须比线程池活得更久
+    Thread_Pool(std::size_t num_thread = default_thread_pool_size(),
+                std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+        : stop_{false}, num_thread_{num_thread}, resource_{resource}
     {
         start();
     }
@@ -43,17 +479,41 @@ public:
 
     template <typename F, typename... Args>
     std::future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> submit(F &&f, Args &&...args)
+    {
+        return submit_in(resource_, std::forward<F>(f), std::forward<Args>(args)...);
+    }
+
+    // 任务对象与 future 的共享状态从 resource 分配（例如请求级别的 arena），resource 必须比 future 与任务活得更久
+    template <typename F, typename... Args>
+    std::future<std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>> submit_in(std::pmr::memory_resource *resource, F &&f, Args &&...args)
     {
         using RetType = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
         if (stop_)
             throw std::runtime_error("ThreadPool is stopped");
-        auto task = std::make_shared<std::packaged_task<RetType()>>(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
-        std::future<RetType> ret = task->get_future();
+        // std::packaged_task 不支持自定义分配器，改用带分配器的 std::promise，任务对象与共享状态都从 resource 分配
+        std::promise<RetType> promise{std::allocator_arg, std::pmr::polymorphic_allocator<RetType>{resource}};
+        std::future<RetType> ret = promise.get_future();
+        Task task{resource, [promise = std::move(promise), fn = std::bind(std::forward<F>(f), std::forward<Args>(args)...)]() mutable
+                  {
+                      try
+                      {
+                          if constexpr (std::is_void_v<RetType>)
+                          {
+                              fn();
+                              promise.set_value();
+                          }
+                          else
+                              promise.set_value(fn());
+                      }
+                      catch (...)
+                      {
+                          promise.set_exception(std::current_exception());
+                      }
+                  }};
 
         {
             std::lock_guard<std::mutex> lock{mutex_};
-            tasks_.emplace([task]
-                           { (*task)(); });
+            tasks_.push(std::move(task));
         }
         cv_.notify_one();
 
@@ -68,18 +528,52 @@ public:
                                {
                 while(!stop_)
                 {
-                    std::unique_lock<std::mutex> lock{mutex_};
-                    cv_.wait(lock, [this]
-                             { return stop_ || !tasks_.empty(); });
-                    if(tasks_.empty())
-                        return;
-                    Task task = std::move(tasks_.front());
-                    tasks_.pop();
-                    task();
+                    Task task;
+                    {
+                        std::unique_lock<std::mutex> lock{mutex_};
+                        cv_.wait(lock, [this]
+                                 { return stop_ || !tasks_.empty(); });
+                        if(tasks_.empty())
+                            return;
+                        task = std::move(tasks_.front());
+                        tasks_.pop();
+                    }
+                    task(); // 执行任务时不能持有锁，否则同一时刻只有一个线程在执行任务
                 } });
         }
     }
 
+    // 在调用线程中执行一个队列中的任务，队列为空返回 false
+    bool run_pending_task()
+    {
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (tasks_.empty())
+                return false;
+            task = std::move(tasks_.front());
+            tasks_.pop();
+        }
+        task();
+        return true;
+    }
+
+    // 等待 future 就绪，等待期间帮忙执行队列中的任务，而不是阻塞在 get() 上
+    // 池中的任务如果直接调用 future.get() 等待子任务，所有线程都可能阻塞在等待上，而子任务还在队列中无人执行，导致死锁
+    template <typename R>
+    R run_until_ready(std::future<R> &future)
+    {
+        while (future.wait_for(0s) != std::future_status::ready)
+        {
+            if (!run_pending_task())
+                std::this_thread::yield();
+        }
+        return future.get();
+    }
+
+    std::size_t size() const noexcept { return num_thread_; }
+    std::pmr::memory_resource *resource() const noexcept { return resource_; }
+
     void stop()
     {
         stop_ = true;
@@ -97,11 +591,19 @@ private:
     std::condition_variable cv_;
     std::atomic_bool stop_;
     std::size_t num_thread_;
+    std::pmr::memory_resource *resource_;
     std::queue<Task> tasks_;
     std::vector<std::thread> pool_;
 };
 
-#if 1
+// 供各个并行算法共享的线程池，首次使用时创建
+inline Thread_Pool &shared_pool()
+{
+    static Thread_Pool pool;
+    return pool;
+}
+
+#ifdef VERSION_1
 
 int print_task(int n)
 {
@@ -164,4 +666,1101 @@ int main()
 #endif
 } // 析构自动 stop()自动 stop()
 
+#elif defined(VERSION_2)
+// 基于线程池的并行排序：与并行 sum 相对应
+/*
+1: 比较排序使用并行归并排序：递归地将区间一分为二，左半部分提交给线程池，右半部分在当前线程排序，最后并行归并
+2: 并行归并：取较长区间的中间元素，在另一个区间中二分查找其位置，将一次归并拆成两个互不相干的归并
+3: 整数键（且使用默认的 std::less）走 LSD 基数排序：每趟按 8 位分桶，各块并行统计直方图、再并行分散
+4: 所有等待子任务的地方都使用 run_until_ready，等待时执行队列中的其它任务，线程数再少也不会死锁
+5: 缓冲区、直方图与子任务对象都从 resource 分配，可以传入请求级别的 arena（见 VERSION_5）
+*/
+
+constexpr std::ptrdiff_t sort_cutoff = 1 << 15; // 小于此规模直接串行，任务调度的开销大于并行的收益
+
+template <typename It1, typename It2, typename OutIt, typename Compare>
+void parallel_merge(Thread_Pool &pool, It1 first1, It1 last1, It2 first2, It2 last2, OutIt out, Compare comp,
+                    std::pmr::memory_resource *resource)
+{
+    std::ptrdiff_t n1 = last1 - first1;
+    std::ptrdiff_t n2 = last2 - first2;
+    if (n1 + n2 <= sort_cutoff)
+    {
+        std::merge(std::make_move_iterator(first1), std::make_move_iterator(last1),
+                   std::make_move_iterator(first2), std::make_move_iterator(last2), out, comp);
+        return;
+    }
+    if (n1 < n2) // 总是拆分较长的区间，保证两半的规模均衡
+        return parallel_merge(pool, first2, last2, first1, last1, out, comp, resource);
+
+    // [first1, mid1) 与 [first2, mid2) 中的元素都不大于 *mid1，其余元素都不小于 *mid1
+    auto mid1 = first1 + n1 / 2;
+    auto mid2 = std::lower_bound(first2, last2, *mid1, comp);
+    auto out_mid = out + (mid1 - first1) + (mid2 - first2);
+
+    auto left = pool.submit_in(resource, [=, &pool]
+                               { parallel_merge(pool, first1, mid1, first2, mid2, out, comp, resource); });
+    parallel_merge(pool, mid1, last1, mid2, last2, out_mid, comp, resource);
+    pool.run_until_ready(left);
+}
+
+// 对 [first, last) 排序。to_buffer 为 true 时结果写入 buffer 的对应区间，否则留在原区间
+// 每层递归交替使用原区间和缓冲区作为归并的目标，避免每次归并后再拷贝回去
+template <typename RandomIt, typename BufferIt, typename Compare>
+void merge_sort_impl(Thread_Pool &pool, RandomIt first, RandomIt last, BufferIt buffer, bool to_buffer, Compare comp,
+                     std::pmr::memory_resource *resource)
+{
+    std::ptrdiff_t n = last - first;
+    if (n <= sort_cutoff)
+    {
+        std::sort(first, last, comp);
+        if (to_buffer)
+            std::move(first, last, buffer);
+        return;
+    }
+    auto mid = first + n / 2;
+    auto buffer_mid = buffer + n / 2;
+
+    auto left = pool.submit_in(resource, [=, &pool]
+                               { merge_sort_impl(pool, first, mid, buffer, !to_buffer, comp, resource); });
+    merge_sort_impl(pool, mid, last, buffer_mid, !to_buffer, comp, resource);
+    pool.run_until_ready(left);
+
+    if (to_buffer)
+        parallel_merge(pool, first, mid, mid, last, buffer, comp, resource);
+    else
+        parallel_merge(pool, buffer, buffer_mid, buffer_mid, buffer + n, first, comp, resource);
+}
+
+template <typename RandomIt>
+void parallel_radix_sort(Thread_Pool &pool, RandomIt first, RandomIt last, std::pmr::memory_resource *resource)
+{
+    using value_type = std::iter_value_t<RandomIt>;
+    using key_type = std::make_unsigned_t<value_type>;
+    static_assert(std::is_integral_v<value_type> && !std::is_same_v<value_type, bool>);
+
+    // 有符号数翻转符号位后，按无符号比较的顺序与原顺序一致
+    constexpr key_type sign_bit = std::is_signed_v<value_type> ? key_type(key_type{1} << (sizeof(key_type) * 8 - 1)) : key_type{0};
+    constexpr std::size_t radix = 256;
+
+    std::ptrdiff_t n = last - first;
+    std::size_t num_chunks = pool.size();
+    std::ptrdiff_t chunk_size = (n + num_chunks - 1) / num_chunks;
+
+    std::pmr::vector<value_type> buffer(n, resource);
+    std::pmr::vector<std::array<std::size_t, radix>> counts(num_chunks, resource);
+    std::pmr::vector<std::future<void>> futures(resource);
+
+    auto wait_all = [&]
+    {
+        for (auto &future : futures)
+            pool.run_until_ready(future);
+        futures.clear();
+    };
+
+    // 数据在原区间与缓冲区之间来回分散，每趟都是稳定的
+    auto pass = [&](auto src, auto dst, unsigned shift)
+    {
+        auto digit = [shift](value_type v)
+        { return (static_cast<key_type>(v) ^ sign_bit) >> shift & (radix - 1); };
+
+        for (std::size_t c = 0; c < num_chunks; ++c)
+        {
+            futures.push_back(pool.submit_in(resource, [&, c]
+                                             {
+                counts[c].fill(0);
+                auto begin = src + std::min(n, chunk_size * std::ptrdiff_t(c));
+                auto end = src + std::min(n, chunk_size * std::ptrdiff_t(c + 1));
+                for (auto it = begin; it != end; ++it)
+                    ++counts[c][digit(*it)]; }));
+        }
+        wait_all();
+
+        // 所有元素的这一位都相同，本趟不改变顺序，直接跳过
+        for (std::size_t d = 0; d < radix; ++d)
+        {
+            std::size_t total = 0;
+            for (auto &count : counts)
+                total += count[d];
+            if (total == std::size_t(n))
+                return false;
+        }
+
+        // 按 (桶, 块) 的顺序求前缀和，得到每个块在每个桶中的写入位置
+        std::size_t offset = 0;
+        for (std::size_t d = 0; d < radix; ++d)
+        {
+            for (auto &count : counts)
+                offset += std::exchange(count[d], offset);
+        }
+
+        for (std::size_t c = 0; c < num_chunks; ++c)
+        {
+            futures.push_back(pool.submit_in(resource, [&, c]
+                                             {
+                auto begin = src + std::min(n, chunk_size * std::ptrdiff_t(c));
+                auto end = src + std::min(n, chunk_size * std::ptrdiff_t(c + 1));
+                for (auto it = begin; it != end; ++it)
+                    dst[counts[c][digit(*it)]++] = *it; }));
+        }
+        wait_all();
+        return true;
+    };
+
+    bool in_buffer = false;
+    for (unsigned shift = 0; shift < sizeof(key_type) * 8; shift += 8)
+    {
+        bool moved = in_buffer ? pass(buffer.begin(), first, shift) : pass(first, buffer.begin(), shift);
+        if (moved)
+            in_buffer = !in_buffer;
+    }
+    if (in_buffer)
+        std::copy(buffer.begin(), buffer.end(), first);
+}
+
+// 元素类型需要可默认构造（归并需要同样大小的缓冲区）
+template <typename RandomIt, typename Compare = std::less<>>
+void parallel_sort(Thread_Pool &pool, RandomIt first, RandomIt last, Compare comp = {},
+                   std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+{
+    using value_type = std::iter_value_t<RandomIt>;
+    std::ptrdiff_t n = last - first;
+    if (n <= sort_cutoff)
+        return std::sort(first, last, comp);
+
+    if constexpr (std::is_integral_v<value_type> && !std::is_same_v<value_type, bool> &&
+                  (std::is_same_v<Compare, std::less<>> || std::is_same_v<Compare, std::less<value_type>>))
+    {
+        parallel_radix_sort(pool, first, last, resource);
+    }
+    else
+    {
+        std::pmr::vector<value_type> buffer(n, resource);
+        merge_sort_impl(pool, first, last, buffer.begin(), false, comp, resource);
+    }
+}
+
+template <typename F>
+double measure(F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// libstdc++ 的 std::execution::par 依赖 TBB，编译时需要链接 -ltbb
+int main()
+{
+    Thread_Pool pool;
+    std::mt19937_64 gen{42};
+
+    // 1e9 个 int 需要 4GB，加上副本与缓冲区约 16GB，内存足够时可以把上限改为 1'000'000'000
+    for (std::size_t n : {100'000u, 1'000'000u, 10'000'000u, 100'000'000u})
+    {
+        std::vector<int> data(n);
+        for (auto &v : data)
+            v = static_cast<int>(gen());
+
+        auto expected = data;
+        auto par = data;
+        auto radix = data;
+        auto merge = data;
+
+        std::cout << "n = " << n << '\n';
+        std::cout << "  std::sort:                 " << measure([&]
+                                                              { std::sort(expected.begin(), expected.end()); })
+                  << " ms\n";
+        std::cout << "  std::sort(par):            " << measure([&]
+                                                              { std::sort(std::execution::par, par.begin(), par.end()); })
+                  << " ms\n";
+        std::cout << "  parallel_sort(radix):      " << measure([&]
+                                                              { parallel_sort(pool, radix.begin(), radix.end()); })
+                  << " ms\n";
+        std::cout << "  parallel_sort(merge):      " << measure([&]
+                                                              { parallel_sort(pool, merge.begin(), merge.end(), [](int a, int b)
+                                                                              { return a < b; }); })
+                  << " ms\n";
+        std::cout << std::boolalpha << "  " << (radix == expected && merge == expected) << '\n';
+    }
+
+    // 池中的任务再提交子任务并等待也不会死锁：等待的线程会去执行队列中的子任务
+    Thread_Pool small_pool{4};
+    std::vector<double> values(2'000'000);
+    for (auto &v : values)
+        v = std::generate_canonical<double, 53>(gen);
+    small_pool.submit([&]
+                      { parallel_sort(small_pool, values.begin(), values.end(), std::greater<>{}); })
+        .get();
+    std::cout << std::boolalpha << std::is_sorted(values.begin(), values.end(), std::greater<>{}) << '\n';
+}
+
+#elif defined(VERSION_3)
+// 将 sum 中切分迭代器区间的逻辑推广为通用的并行算法，统一运行在共享的线程池上，而不是每次手动创建线程
+/*
+1: parallel_for_each     对每个元素调用 f
+2: parallel_transform    将 f(*it) 写入输出区间
+3: parallel_map_reduce   map 将每个元素映射为 (键, 值)，相同键的值用 combine 合并，返回键到值的映射
+
+异常处理：
+1: 每块的任务自己捕获异常，只记录第一个异常，并设置取消标志
+2: 尚未开始执行的块看到取消标志后直接返回；已经在执行的块会执行完
+3: 等待所有块结束后，在调用线程中重新抛出第一个异常。必须等所有块结束，因为任务引用了调用方栈上的数据
+边界、局部哈希表与子任务对象都从 resource 分配，可以传入请求级别的 arena（见 VERSION_5）；parallel_map_reduce 返回的结果仍使用默认分配器
+*/
+
+// 每个线程大约分到 4 块，块太少负载不均，块太多调度开销大
+constexpr std::size_t chunks_per_thread = 4;
+constexpr std::ptrdiff_t min_chunk_size = 1024;
+
+class chunk_group
+{
+    std::atomic_bool cancelled_{false};
+    std::once_flag error_flag_;
+    std::exception_ptr error_;
+
+public:
+    bool cancelled() const noexcept { return cancelled_.load(std::memory_order_relaxed); }
+
+    template <typename F>
+    void run(F &f) noexcept
+    {
+        if (cancelled())
+            return;
+        try
+        {
+            f();
+        }
+        catch (...)
+        {
+            std::call_once(error_flag_, [this]
+                           { error_ = std::current_exception(); });
+            cancelled_.store(true, std::memory_order_relaxed);
+        }
+    }
+
+    void rethrow_if_failed() const
+    {
+        if (error_)
+            std::rethrow_exception(error_);
+    }
+};
+
+// 返回 num_chunks + 1 个边界。前向迭代器只能逐个前进，因此只走一遍区间，依次记录每块的终点
+template <typename ForwardIt>
+std::pmr::vector<ForwardIt> split_range(ForwardIt first, std::ptrdiff_t distance, std::size_t num_chunks,
+                                        std::pmr::memory_resource *resource)
+{
+    std::size_t chunk_size = distance / num_chunks;
+    std::size_t remainder = distance % num_chunks;
+
+    std::pmr::vector<ForwardIt> bounds(resource);
+    bounds.reserve(num_chunks + 1);
+    bounds.push_back(first);
+    for (std::size_t i = 0; i < num_chunks; ++i)
+        bounds.push_back(std::next(bounds.back(), chunk_size + (i < remainder ? 1 : 0)));
+    return bounds;
+}
+
+inline std::size_t chunk_count(Thread_Pool &pool, std::ptrdiff_t distance)
+{
+    std::size_t by_size = std::max<std::ptrdiff_t>(1, distance / min_chunk_size);
+    return std::min(by_size, pool.size() * chunks_per_thread);
+}
+
+// body(i) 执行第 i 块。第 0 块在调用线程中执行，其余提交到线程池
+template <typename Body>
+void run_chunks(Thread_Pool &pool, std::size_t num_chunks, Body body, std::pmr::memory_resource *resource)
+{
+    chunk_group group;
+    std::pmr::vector<std::future<void>> futures(resource);
+    futures.reserve(num_chunks);
+    for (std::size_t i = 1; i < num_chunks; ++i)
+    {
+        futures.push_back(pool.submit_in(resource, [&group, &body, i]
+                                         {
+            auto f = [&] { body(i); };
+            group.run(f); }));
+    }
+    auto first_chunk = [&]
+    { body(0); };
+    group.run(first_chunk);
+
+    for (auto &future : futures)
+        pool.run_until_ready(future);
+    group.rethrow_if_failed();
+}
+
+template <typename ForwardIt, typename F>
+void parallel_for_each(ForwardIt first, ForwardIt last, F f, Thread_Pool &pool = shared_pool(),
+                       std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+{
+    std::ptrdiff_t distance = std::distance(first, last);
+    std::size_t num_chunks = chunk_count(pool, distance);
+    auto bounds = split_range(first, distance, num_chunks, resource);
+    run_chunks(pool, num_chunks, [&](std::size_t i)
+               { std::for_each(bounds[i], bounds[i + 1], f); }, resource);
+}
+
+template <typename ForwardIt1, typename ForwardIt2, typename F>
+ForwardIt2 parallel_transform(ForwardIt1 first, ForwardIt1 last, ForwardIt2 d_first, F f, Thread_Pool &pool = shared_pool(),
+                              std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+{
+    std::ptrdiff_t distance = std::distance(first, last);
+    std::size_t num_chunks = chunk_count(pool, distance);
+    auto bounds = split_range(first, distance, num_chunks, resource);
+    auto d_bounds = split_range(d_first, distance, num_chunks, resource);
+    run_chunks(pool, num_chunks, [&](std::size_t i)
+               { std::transform(bounds[i], bounds[i + 1], d_bounds[i], f); }, resource);
+    return d_bounds.back();
+}
+
+// map(*it) 返回一个 (键, 值) 对。每块先在局部的哈希表中合并，最后按块的顺序合并到结果中
+template <typename ForwardIt, typename Map, typename Combine>
+auto parallel_map_reduce(ForwardIt first, ForwardIt last, Map map, Combine combine, Thread_Pool &pool = shared_pool(),
+                         std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+{
+    using pair_type = std::invoke_result_t<Map &, std::iter_reference_t<ForwardIt>>;
+    using key_type = std::remove_cvref_t<std::tuple_element_t<0, pair_type>>;
+    using mapped_type = std::remove_cvref_t<std::tuple_element_t<1, pair_type>>;
+    using result_type = std::unordered_map<key_type, mapped_type>;
+    using partial_type = std::pmr::unordered_map<key_type, mapped_type>;
+
+    auto merge = [&combine](auto &result, key_type key, mapped_type value)
+    {
+        if (auto [it, inserted] = result.try_emplace(std::move(key), value); !inserted)
+            it->second = combine(std::move(it->second), std::move(value));
+    };
+
+    std::ptrdiff_t distance = std::distance(first, last);
+    std::size_t num_chunks = chunk_count(pool, distance);
+    auto bounds = split_range(first, distance, num_chunks, resource);
+    std::pmr::vector<partial_type> partials(num_chunks, resource); // 每个局部哈希表同样使用 resource
+    run_chunks(pool, num_chunks, [&](std::size_t i)
+               {
+        for (auto it = bounds[i]; it != bounds[i + 1]; ++it)
+        {
+            auto [key, value] = map(*it);
+            merge(partials[i], std::move(key), std::move(value));
+        } }, resource);
+
+    // 结果返回给调用方，可能活得比 resource 更久，因此使用默认分配器
+    result_type result;
+    for (std::size_t i = 0; i < num_chunks; ++i)
+    {
+        for (auto &[key, value] : partials[i])
+            merge(result, key, std::move(value));
+    }
+    return result;
+}
+
+int main()
+{
+    std::vector<int> v(1'000'000);
+    std::iota(v.begin(), v.end(), 0);
+
+    parallel_for_each(v.begin(), v.end(), [](int &n)
+                      { n %= 100; });
+
+    std::vector<long long> squares(v.size());
+    parallel_transform(v.begin(), v.end(), squares.begin(), [](int n)
+                       { return 1LL * n * n; });
+    std::cout << std::accumulate(squares.begin(), squares.end(), 0LL) << '\n'; // 3283500000
+
+    // 前向迭代器：单词计数
+    std::list<std::string> words;
+    for (int i = 0; i < 100'000; ++i)
+        words.push_back(i % 3 == 0 ? "fizz" : (i % 5 == 0 ? "buzz" : "other"));
+    auto counts = parallel_map_reduce(words.begin(), words.end(), [](const std::string &word)
+                                      { return std::pair{word, 1}; }, std::plus<>{});
+    for (const auto &[word, count] : counts)
+        std::cout << word << ": " << count << '\n';
+
+    // 第一个异常传播到调用方，之后未开始的块被取消
+    std::atomic_int visited{0};
+    try
+    {
+        parallel_for_each(v.begin(), v.end(), [&](int n)
+                          {
+            ++visited;
+            if (n == 42)
+                throw std::runtime_error("元素 42 处理失败"); });
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "捕获异常: " << e.what() << ", 已处理 " << visited << " / " << v.size() << " 个元素\n";
+    }
+}
+
+#elif defined(VERSION_4)
+// slab_resource：热路径上的小对象分配
+/*
+slab_resource 定义在文件开头，Thread_Pool 的构造函数可以指定任务对象与 future 共享状态所用的 memory_resource
+这里对比默认的 new/delete 与 slab_resource：
+1: 线程池提交大量小任务
+2: 大量创建 std::promise/std::future
+3: 生产者-消费者队列：生产者分配、消费者释放（跨线程释放，依赖成批归还全局池）
+*/
+
+// 与 syn_asyn_operation.cpp VERSION_2 相同的线程安全队列，容器与 wait_and_pop 中的 shared_ptr 都从 memory_resource 分配
+template <typename T>
+class threadsafe_queue
+{
+    mutable std::mutex m;
+    std::condition_variable data_cond;
+    std::queue<T, std::pmr::deque<T>> data_queue;
+    std::pmr::polymorphic_allocator<T> alloc;
+
+public:
+    explicit threadsafe_queue(std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+        : data_queue(std::pmr::deque<T>(resource)), alloc(resource) {}
+
+    void push(T new_value)
+    {
+        {
+            std::lock_guard<std::mutex> lk{m};
+            data_queue.push(std::move(new_value));
+        }
+        data_cond.notify_one();
+    }
+
+    std::shared_ptr<T> wait_and_pop()
+    {
+        std::unique_lock<std::mutex> lk{m};
+        data_cond.wait(lk, [this]
+                       { return !data_queue.empty(); });
+        auto res = std::allocate_shared<T>(alloc, std::move(data_queue.front()));
+        data_queue.pop();
+        return res;
+    }
+};
+
+struct message
+{
+    std::uint64_t id;
+    std::array<char, 40> payload;
+};
+
+template <typename F>
+double measure_ms(F &&f)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::forward<F>(f)();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+double pool_benchmark(std::pmr::memory_resource *resource, std::size_t num_tasks)
+{
+    Thread_Pool pool{default_thread_pool_size(), resource};
+    std::vector<std::future<std::size_t>> futures;
+    futures.reserve(num_tasks);
+    return measure_ms([&]
+                      {
+        for (std::size_t i = 0; i < num_tasks; ++i)
+            futures.push_back(pool.submit([i] { return i; }));
+        std::size_t sum = 0;
+        for (auto &f : futures)
+            sum += pool.run_until_ready(f);
+        if (sum != num_tasks * (num_tasks - 1) / 2)
+            throw std::logic_error("结果错误"); });
+}
+
+double promise_benchmark(std::pmr::memory_resource *resource, std::size_t num_threads, std::size_t iterations)
+{
+    return measure_ms([&]
+                      {
+        std::vector<std::jthread> threads;
+        for (std::size_t t = 0; t < num_threads; ++t)
+            threads.emplace_back([&]
+                                 {
+                long long sum = 0;
+                for (std::size_t i = 0; i < iterations; ++i)
+                {
+                    std::promise<int> p{std::allocator_arg, std::pmr::polymorphic_allocator<int>{resource}};
+                    auto f = p.get_future();
+                    p.set_value(static_cast<int>(i));
+                    sum += f.get();
+                }
+                if (sum < 0)
+                    throw std::logic_error("结果错误"); }); });
+}
+
+double queue_benchmark(std::pmr::memory_resource *resource, std::size_t num_messages)
+{
+    std::pmr::polymorphic_allocator<> alloc{resource};
+    threadsafe_queue<message *> queue{resource};
+    return measure_ms([&]
+                      {
+        std::jthread producer{[&]
+                              {
+            for (std::size_t i = 0; i < num_messages; ++i)
+                queue.push(alloc.new_object<message>(message{i, {}}));
+            queue.push(nullptr); }};
+        std::jthread consumer{[&]
+                              {
+            while (message *msg = *queue.wait_and_pop())
+                alloc.delete_object(msg); }}; });
+}
+
+int main()
+{
+    slab_resource slab;
+
+    Thread_Pool pool{4, &slab};
+    auto f = pool.submit([](int a, int b)
+                         { return a + b; }, 1, 2);
+    std::cout << f.get() << '\n'; // 3
+    auto g = pool.submit([]
+                         { throw std::runtime_error("任务失败"); });
+    try
+    {
+        g.get();
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "捕获异常: " << e.what() << '\n';
+    }
+
+    std::pmr::memory_resource *malloc_resource = std::pmr::new_delete_resource();
+    std::size_t num_threads = std::max(4u, std::thread::hardware_concurrency());
+    std::cout << "场景\tnew/delete\tslab_resource（毫秒）\n";
+    std::cout << "线程池提交 1e6 个任务\t" << pool_benchmark(malloc_resource, 1'000'000)
+              << '\t' << pool_benchmark(&slab, 1'000'000) << '\n';
+    std::cout << num_threads << " 个线程各创建 1e6 个 promise\t" << promise_benchmark(malloc_resource, num_threads, 1'000'000)
+              << '\t' << promise_benchmark(&slab, num_threads, 1'000'000) << '\n';
+    std::cout << "生产者-消费者 1e6 条消息\t" << queue_benchmark(malloc_resource, 1'000'000)
+              << '\t' << queue_benchmark(&slab, 1'000'000) << '\n';
+}
+
+#elif defined(VERSION_5)
+// 请求级别的 arena：一个请求内的临时缓冲区与任务对象都从 arena 分配，请求结束时一次性回收
+/*
+arena_resource 定义在文件开头，VERSION_2 的并行排序、VERSION_3 的并行算法与 Thread_Pool::submit_in 都接受 std::pmr::memory_resource*
+这里把它们组合成一个“请求”：排序、按键归约、再提交一批小任务。对比默认的 new/delete 与每个请求复用同一个 arena
+arena 的收益来自省掉逐个释放、以及跨线程释放时 malloc 内部的锁竞争（任务对象由提交线程分配、在工作线程中释放）；
+代价是请求内释放的内存不会被复用，请求占用的内存只增不减。核数很少、malloc 的线程缓存命中率高时两者差别不大，甚至 arena 更慢，应以实测为准
+*/
+
+constexpr std::ptrdiff_t sort_cutoff = 1 << 15;
+
+template <typename It1, typename It2, typename OutIt, typename Compare>
+void parallel_merge(Thread_Pool &pool, It1 first1, It1 last1, It2 first2, It2 last2, OutIt out, Compare comp,
+                    std::pmr::memory_resource *resource)
+{
+    std::ptrdiff_t n1 = last1 - first1;
+    std::ptrdiff_t n2 = last2 - first2;
+    if (n1 + n2 <= sort_cutoff)
+    {
+        std::merge(std::make_move_iterator(first1), std::make_move_iterator(last1),
+                   std::make_move_iterator(first2), std::make_move_iterator(last2), out, comp);
+        return;
+    }
+    if (n1 < n2)
+        return parallel_merge(pool, first2, last2, first1, last1, out, comp, resource);
+
+    auto mid1 = first1 + n1 / 2;
+    auto mid2 = std::lower_bound(first2, last2, *mid1, comp);
+    auto out_mid = out + (mid1 - first1) + (mid2 - first2);
+
+    auto left = pool.submit_in(resource, [=, &pool]
+                               { parallel_merge(pool, first1, mid1, first2, mid2, out, comp, resource); });
+    parallel_merge(pool, mid1, last1, mid2, last2, out_mid, comp, resource);
+    pool.run_until_ready(left);
+}
+
+template <typename RandomIt, typename BufferIt, typename Compare>
+void merge_sort_impl(Thread_Pool &pool, RandomIt first, RandomIt last, BufferIt buffer, bool to_buffer, Compare comp,
+                     std::pmr::memory_resource *resource)
+{
+    std::ptrdiff_t n = last - first;
+    if (n <= sort_cutoff)
+    {
+        std::sort(first, last, comp);
+        if (to_buffer)
+            std::move(first, last, buffer);
+        return;
+    }
+    auto mid = first + n / 2;
+    auto buffer_mid = buffer + n / 2;
+
+    auto left = pool.submit_in(resource, [=, &pool]
+                               { merge_sort_impl(pool, first, mid, buffer, !to_buffer, comp, resource); });
+    merge_sort_impl(pool, mid, last, buffer_mid, !to_buffer, comp, resource);
+    pool.run_until_ready(left);
+
+    if (to_buffer)
+        parallel_merge(pool, first, mid, mid, last, buffer, comp, resource);
+    else
+        parallel_merge(pool, buffer, buffer_mid, buffer_mid, buffer + n, first, comp, resource);
+}
+
+template <typename RandomIt, typename Compare>
+void parallel_merge_sort(Thread_Pool &pool, RandomIt first, RandomIt last, Compare comp, std::pmr::memory_resource *resource)
+{
+    std::pmr::vector<std::iter_value_t<RandomIt>> buffer(last - first, resource);
+    merge_sort_impl(pool, first, last, buffer.begin(), false, comp, resource);
+}
+
+// 一个请求：数据、缓冲区、局部哈希表、任务对象与 future 的共享状态全部来自 resource
+long long handle_request(Thread_Pool &pool, std::pmr::memory_resource *resource, std::uint64_t seed)
+{
+    std::mt19937_64 gen{seed};
+    std::pmr::vector<std::uint32_t> data(1 << 16, resource);
+    for (auto &v : data)
+        v = static_cast<std::uint32_t>(gen());
+    parallel_merge_sort(pool, data.begin(), data.end(), std::greater<>{}, resource);
+
+    std::pmr::unordered_map<std::uint32_t, long long> histogram(resource);
+    for (std::size_t i = 0; i < data.size(); i += 16)
+        histogram[data[i] % 1024] += 1;
+
+    // 大量短小的任务：分配任务对象与共享状态的开销与任务本身相当
+    std::pmr::vector<std::future<long long>> futures(resource);
+    futures.reserve(4096);
+    for (std::size_t i = 0; i < 4096; ++i)
+        futures.push_back(pool.submit_in(resource, [&data, i]
+                                         { return static_cast<long long>(data[i * 16] % 1000); }));
+    long long sum = 0;
+    for (auto &f : futures)
+        sum += pool.run_until_ready(f);
+    return sum + static_cast<long long>(histogram.size()) + (std::is_sorted(data.begin(), data.end(), std::greater<>{}) ? 0 : -1);
+}
+
+template <typename F>
+double measure_ms(F &&f)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::forward<F>(f)();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+    Thread_Pool pool;
+    constexpr std::uint64_t num_requests = 200;
+
+    long long expected = 0, actual = 0;
+    double heap_ms = measure_ms([&]
+                                {
+        for (std::uint64_t r = 0; r < num_requests; ++r)
+            expected += handle_request(pool, std::pmr::new_delete_resource(), r); });
+
+    arena_resource arena;
+    double arena_ms = measure_ms([&]
+                                 {
+        for (std::uint64_t r = 0; r < num_requests; ++r)
+        {
+            arena_scope scope{arena}; // 请求结束时 reset()
+            actual += handle_request(pool, scope.resource(), r);
+        } });
+
+    std::cout << std::boolalpha << (expected == actual) << '\n';
+    std::cout << num_requests << " 个请求\tnew/delete: " << heap_ms << " ms\tarena: " << arena_ms << " ms\n";
+    std::cout << "arena 保留的内存: " << arena.capacity() / 1024 << " KiB\n";
+}
+
+#elif defined(VERSION_6)
+// 异步记忆化缓存：键映射到 shared_future，加载在线程池中进行
+/*
+async_cache 把“按键加载一个慢的值”包装成 shared_future，并在其上提供：
+1: 合并加载：同一个键的并发未命中只提交一次加载任务，其余调用者拿到同一个 shared_future
+2: TTL：值在加载完成 ttl 之后过期；过期后 stale_while_revalidate 时间内仍然立即返回旧值，同时在线程池中刷新（每个条目同时只有一个刷新任务）
+   超过这个时间才视为未命中，调用者等待新的加载。加载失败的结果不缓存，等待中的调用者得到异常，之后的调用重新加载
+3: 容量有上限，键空间分成若干分片，每个分片有自己的 shared_mutex 和一个 CLOCK 环：
+   LRU 每次命中都要把条目移到链表头，只能加独占锁；CLOCK 命中时只需要置位条目的原子引用位，因此命中只加所在分片的共享锁，不存在全局锁
+   淘汰时指针绕环扫描，清除引用位，遇到引用位已为 0 的条目就淘汰它（仍在首次加载中的条目尽量跳过，避免破坏合并）
+4: 统计命中、旧值命中、未命中、淘汰、加载失败次数以及加载延迟（从提交到完成，包括在线程池中排队的时间），计数器按分片存放，读取时汇总
+加载任务持有条目的 shared_ptr，条目被淘汰后任务仍可安全完成；缓存析构时等待所有加载任务结束
+*/
+
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class async_cache
+{
+public:
+    using clock = std::chrono::steady_clock;
+    using loader_type = std::function<Value(const Key &)>;
+
+    struct options
+    {
+        std::size_t capacity = 1024;
+        std::size_t shards = 16;
+        clock::duration ttl = 1s;
+        clock::duration stale_while_revalidate = 0s;
+    };
+
+    struct metrics
+    {
+        std::uint64_t hits = 0;
+        std::uint64_t stale_hits = 0;
+        std::uint64_t misses = 0;
+        std::uint64_t evictions = 0;
+        std::uint64_t loads = 0;
+        std::uint64_t load_errors = 0;
+        double mean_load_ms = 0;
+        double max_load_ms = 0;
+    };
+
+    async_cache(Thread_Pool &pool, loader_type loader, const options &opts = options{})
+        : pool_(pool), loader_(std::move(loader)), ttl_(to_ns(opts.ttl)), stale_(to_ns(opts.stale_while_revalidate)),
+          shards_(std::max<std::size_t>(1, opts.shards)), origin_(clock::now())
+    {
+        std::size_t per_shard = std::max<std::size_t>(1, (opts.capacity + shards_.size() - 1) / shards_.size());
+        for (auto &s : shards_)
+            s.capacity = per_shard;
+    }
+    async_cache(const async_cache &) = delete;
+    async_cache &operator=(const async_cache &) = delete;
+
+    ~async_cache()
+    {
+        std::unique_lock<std::mutex> lk{pending_mutex_};
+        pending_cv_.wait(lk, [this]
+                         { return pending_ == 0; });
+    }
+
+    std::shared_future<Value> get(const Key &key)
+    {
+        shard &s = shard_for(key);
+        const auto now = elapsed();
+        {
+            std::shared_lock<std::shared_mutex> lk{s.m};
+            if (auto it = s.index.find(key); it != s.index.end())
+            {
+                const auto &e = s.slots[it->second];
+                if (auto future = try_hit(s, e, now))
+                    return *future;
+            }
+        }
+
+        std::lock_guard<std::shared_mutex> lk{s.m};
+        auto it = s.index.find(key);
+        if (it != s.index.end())
+        {
+            // 加锁的间隙里可能已有其它线程开始了加载
+            if (auto future = try_hit(s, s.slots[it->second], now))
+                return *future;
+        }
+        s.misses.fetch_add(1, std::memory_order_relaxed);
+        auto e = std::make_shared<entry>(key);
+        auto future = start_load(e);
+        if (it != s.index.end())
+            s.slots[it->second] = std::move(e);
+        else
+            insert(s, std::move(e));
+        return future;
+    }
+
+    bool erase(const Key &key)
+    {
+        shard &s = shard_for(key);
+        std::lock_guard<std::shared_mutex> lk{s.m};
+        auto it = s.index.find(key);
+        if (it == s.index.end())
+            return false;
+        remove_slot(s, it->second);
+        return true;
+    }
+
+    std::size_t size()
+    {
+        std::size_t n = 0;
+        for (auto &s : shards_)
+        {
+            std::shared_lock<std::shared_mutex> lk{s.m};
+            n += s.slots.size();
+        }
+        return n;
+    }
+
+    metrics snapshot() const
+    {
+        metrics m;
+        std::uint64_t total_ns = 0, max_ns = 0;
+        for (auto &s : shards_)
+        {
+            m.hits += s.hits.load(std::memory_order_relaxed);
+            m.stale_hits += s.stale_hits.load(std::memory_order_relaxed);
+            m.misses += s.misses.load(std::memory_order_relaxed);
+            m.evictions += s.evictions.load(std::memory_order_relaxed);
+            m.loads += s.loads.load(std::memory_order_relaxed);
+            m.load_errors += s.load_errors.load(std::memory_order_relaxed);
+            total_ns += s.load_ns.load(std::memory_order_relaxed);
+            max_ns = std::max(max_ns, s.max_load_ns.load(std::memory_order_relaxed));
+        }
+        m.mean_load_ms = m.loads ? total_ns / 1e6 / m.loads : 0;
+        m.max_load_ms = max_ns / 1e6;
+        return m;
+    }
+
+private:
+    static constexpr std::int64_t loading = std::numeric_limits<std::int64_t>::max();
+
+    struct entry
+    {
+        explicit entry(const Key &k) : key(k) {}
+
+        Key key;
+        std::shared_future<Value> value;             // 修改时持有分片的独占锁
+        std::atomic<std::int64_t> expires_at{loading}; // 首次加载完成前为 loading
+        std::atomic_bool failed{false};
+        std::atomic_bool referenced{true}; // CLOCK 引用位
+        std::atomic_bool refreshing{false};
+    };
+
+    struct alignas(64) shard
+    {
+        std::shared_mutex m;
+        std::unordered_map<Key, std::size_t, Hash> index; // 键到 slots 下标
+        std::vector<std::shared_ptr<entry>> slots;        // CLOCK 环
+        std::size_t hand = 0;
+        std::size_t capacity = 0;
+
+        std::atomic<std::uint64_t> hits{0}, stale_hits{0}, misses{0}, evictions{0}, loads{0}, load_errors{0};
+        std::atomic<std::uint64_t> load_ns{0}, max_load_ns{0};
+    };
+
+    Thread_Pool &pool_;
+    loader_type loader_;
+    std::int64_t ttl_;
+    std::int64_t stale_;
+    std::vector<shard> shards_;
+    Hash hash_;
+    clock::time_point origin_;
+    // 未完成的加载任务数；在锁内通知，否则析构函数可能在任务通知之前返回
+    std::mutex pending_mutex_;
+    std::condition_variable pending_cv_;
+    std::size_t pending_ = 0;
+
+    static std::int64_t to_ns(clock::duration d) { return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(); }
+    std::int64_t elapsed() const { return to_ns(clock::now() - origin_); }
+
+    shard &shard_for(const Key &key) { return shards_[hash_(key) % shards_.size()]; }
+
+    // 在共享锁或独占锁下调用；条目可用时返回它的 future（必要时触发后台刷新），需要重新加载时返回空
+    std::optional<std::shared_future<Value>> try_hit(shard &s, const std::shared_ptr<entry> &e, std::int64_t now)
+    {
+        auto expires_at = e->expires_at.load(std::memory_order_acquire);
+        if (expires_at != loading && e->failed.load(std::memory_order_relaxed))
+            return std::nullopt;
+        if (expires_at != loading && now >= expires_at)
+        {
+            if (now - expires_at >= stale_)
+                return std::nullopt;
+            s.stale_hits.fetch_add(1, std::memory_order_relaxed);
+            if (!e->refreshing.exchange(true, std::memory_order_relaxed))
+                start_refresh(s, e);
+        }
+        else
+            s.hits.fetch_add(1, std::memory_order_relaxed);
+        // 引用位已经置位时不再写，避免热点条目的缓存行在读者之间来回传递
+        if (!e->referenced.load(std::memory_order_relaxed))
+            e->referenced.store(true, std::memory_order_relaxed);
+        return e->value;
+    }
+
+    void record_load(shard &s, clock::time_point start, bool ok)
+    {
+        auto ns = static_cast<std::uint64_t>(to_ns(clock::now() - start));
+        s.loads.fetch_add(1, std::memory_order_relaxed);
+        if (!ok)
+            s.load_errors.fetch_add(1, std::memory_order_relaxed);
+        s.load_ns.fetch_add(ns, std::memory_order_relaxed);
+        for (auto max = s.max_load_ns.load(std::memory_order_relaxed);
+             ns > max && !s.max_load_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed);)
+            ;
+    }
+
+    template <typename F>
+    void submit(F &&f)
+    {
+        {
+            std::lock_guard<std::mutex> lk{pending_mutex_};
+            ++pending_;
+        }
+        pool_.submit([this, f = std::forward<F>(f)]() mutable
+                     {
+            f();
+            std::lock_guard<std::mutex> lk{pending_mutex_};
+            if (--pending_ == 0)
+                pending_cv_.notify_all(); });
+    }
+
+    // 在分片的独占锁下调用
+    std::shared_future<Value> start_load(const std::shared_ptr<entry> &e)
+    {
+        std::promise<Value> promise;
+        e->value = promise.get_future().share();
+        submit([this, e, promise = std::move(promise), start = clock::now()]() mutable
+               {
+            shard &s = shard_for(e->key);
+            try
+            {
+                Value value = loader_(e->key);
+                record_load(s, start, true);
+                e->expires_at.store(elapsed() + ttl_, std::memory_order_release);
+                promise.set_value(std::move(value));
+            }
+            catch (...)
+            {
+                record_load(s, start, false);
+                e->failed.store(true, std::memory_order_relaxed);
+                e->expires_at.store(0, std::memory_order_release);
+                promise.set_exception(std::current_exception());
+            } });
+        return e->value;
+    }
+
+    // 刷新成功才替换旧值；失败时继续提供旧值，直到超出 stale_while_revalidate
+    void start_refresh(shard &s, const std::shared_ptr<entry> &e)
+    {
+        submit([this, &s, e, start = clock::now()]
+               {
+            try
+            {
+                std::promise<Value> promise;
+                promise.set_value(loader_(e->key));
+                std::lock_guard<std::shared_mutex> lk{s.m};
+                e->value = promise.get_future().share();
+                e->expires_at.store(elapsed() + ttl_, std::memory_order_release);
+                record_load(s, start, true);
+            }
+            catch (...)
+            {
+                record_load(s, start, false);
+            }
+            e->refreshing.store(false, std::memory_order_relaxed); });
+    }
+
+    // 以下在分片的独占锁下调用
+    void insert(shard &s, std::shared_ptr<entry> e)
+    {
+        if (s.slots.size() < s.capacity)
+        {
+            s.index.emplace(e->key, s.slots.size());
+            s.slots.push_back(std::move(e));
+            return;
+        }
+        // 转两圈仍找不到时，说明环中全是刚被访问或仍在加载的条目，淘汰指针处的条目
+        for (std::size_t scanned = 0;; ++scanned, s.hand = (s.hand + 1) % s.slots.size())
+        {
+            auto &victim = s.slots[s.hand];
+            bool in_flight = victim->expires_at.load(std::memory_order_relaxed) == loading;
+            if (scanned < 2 * s.slots.size() && (victim->referenced.exchange(false, std::memory_order_relaxed) || in_flight))
+                continue;
+            s.index.erase(victim->key);
+            s.evictions.fetch_add(1, std::memory_order_relaxed);
+            s.index.emplace(e->key, s.hand);
+            victim = std::move(e);
+            s.hand = (s.hand + 1) % s.slots.size();
+            return;
+        }
+    }
+
+    void remove_slot(shard &s, std::size_t slot)
+    {
+        s.index.erase(s.slots[slot]->key);
+        if (slot != s.slots.size() - 1)
+        {
+            s.slots[slot] = std::move(s.slots.back());
+            s.index[s.slots[slot]->key] = slot;
+        }
+        s.slots.pop_back();
+        if (s.hand >= s.slots.size())
+            s.hand = 0;
+    }
+};
+
+// 后端桩函数：每次加载耗时 20ms，键为负数时失败
+std::atomic_int backend_loads{0};
+
+std::string slow_load(const int &key)
+{
+    backend_loads.fetch_add(1, std::memory_order_relaxed);
+    std::this_thread::sleep_for(20ms);
+    if (key < 0)
+        throw std::runtime_error("加载失败: " + std::to_string(key));
+    return "value-" + std::to_string(key) + "-" + std::to_string(backend_loads.load(std::memory_order_relaxed));
+}
+
+template <typename Cache>
+void print_metrics(const char *name, const Cache &cache)
+{
+    auto m = cache.snapshot();
+    std::cout << name << ": 命中 " << m.hits << "，旧值命中 " << m.stale_hits << "，未命中 " << m.misses
+              << "，淘汰 " << m.evictions << "，加载 " << m.loads << "（失败 " << m.load_errors << "），平均加载 "
+              << m.mean_load_ms << " ms，最长 " << m.max_load_ms << " ms，后端调用 " << backend_loads.exchange(0) << '\n';
+}
+
+int main()
+{
+    Thread_Pool pool{4};
+    {
+        // 合并加载：32 个线程同时请求同一个键，后端只调用一次；失败的结果不缓存
+        async_cache<int, std::string> cache{pool, slow_load};
+        std::atomic_int errors{0};
+        {
+            std::vector<std::jthread> threads;
+            for (int i = 0; i < 32; ++i)
+                threads.emplace_back([&, i]
+                                     {
+                    try
+                    {
+                        cache.get(i % 2 ? 7 : -7).get();
+                    }
+                    catch (const std::exception &)
+                    {
+                        ++errors;
+                    } });
+        }
+        std::cout << "失败 " << errors << " 个，";
+        cache.get(7).get();
+        try
+        {
+            cache.get(-7).get(); // 重新加载
+        }
+        catch (const std::exception &e)
+        {
+            std::cout << e.what() << '\n';
+        }
+        print_metrics("合并加载", cache);
+    }
+    {
+        // TTL 100ms，之后 200ms 内返回旧值并在后台刷新
+        async_cache<int, std::string> cache{pool, slow_load, {.ttl = 100ms, .stale_while_revalidate = 200ms}};
+        auto timed_get = [&](const char *when)
+        {
+            auto start = std::chrono::steady_clock::now();
+            auto value = cache.get(1).get();
+            std::cout << "  " << when << ": " << value << "，用时 "
+                      << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() << " ms\n";
+        };
+        timed_get("首次（未命中）");
+        timed_get("立即再取（命中）");
+        std::this_thread::sleep_for(150ms);
+        timed_get("过期 50ms（返回旧值，后台刷新）");
+        std::this_thread::sleep_for(50ms);
+        timed_get("刷新之后（新值）");
+        std::this_thread::sleep_for(400ms);
+        timed_get("超出旧值窗口（未命中）");
+        print_metrics("TTL", cache);
+    }
+    {
+        // 容量 256，8 个线程按偏斜分布访问 2048 个键：热点键留在缓存中
+        async_cache<int, std::string> cache{pool, [](const int &key)
+                                            { backend_loads.fetch_add(1, std::memory_order_relaxed); return std::to_string(key); },
+                                            {.capacity = 256, .ttl = 10s}};
+        {
+            std::vector<std::jthread> threads;
+            for (int t = 0; t < 8; ++t)
+                threads.emplace_back([&, t]
+                                     {
+                    std::mt19937 gen{static_cast<unsigned>(t)};
+                    std::exponential_distribution<double> dist{1.0 / 64};
+                    for (int i = 0; i < 20000; ++i)
+                        cache.get(std::min(2047, static_cast<int>(dist(gen)))).get(); });
+        }
+        print_metrics("偏斜访问", cache);
+        std::cout << "  缓存条目 " << cache.size() << '\n';
+    }
+}
+
 #endif
\ No newline at end of file
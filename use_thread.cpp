@@ -1,16 +1,27 @@
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <exception>
+#include <execution>
 #include <functional>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <list>
+#include <map>
+#include <mutex>
 #include <numeric>
+#include <source_location>
 #include <string>
+#include <string_view>
 #include <syncstream>
 #include <thread>
+#include <tuple>
 #include <vector>
 using namespace std::chrono_literals;
 
-#define VERSION_15
+#define VERSION_17
 
 #ifdef VERSION_1
 void hello()
@@ -648,4 +659,389 @@ std::stop_token：
 通过调用 stop_token.stop_requested()，线程可以检测到停止状态是否已被设置为“已请求停止”
 */
 
+#elif defined(VERSION_16)
+// 并行前缀和（扫描）: 在 sum 的分块方式之上计算“累计和”，用于求偏移、直方图、压缩等
+/*
+inclusive_scan: out[i] = in[0] op in[1] op ... op in[i]
+exclusive_scan: out[i] = init op in[0] op ... op in[i-1]
+
+并行扫描分为两趟：
+1: 每个线程对自己的块求局部总和（同 sum 的分块）
+2: 对各块的总和做一次串行扫描（块数量很少），得到每个块的起始偏移
+3: 每个线程以自己的偏移为初值，对块内做一次局部扫描并写出结果
+op 必须满足结合律，否则分块求值的结果与串行不同；各块总是按顺序合并，所以不要求交换律（字符串拼接、矩阵乘法都可以）
+*/
+
+// 块内按顺序累加，只要求结合律。std::reduce 可能重新分组、调换顺序，还要求交换律，
+// 因此只在算术类型加法（满足交换律）时才使用 unseq 执行策略，允许标准库对块内的循环进行向量化（SIMD）
+template <typename ForwardIt, typename T, typename BinaryOp>
+T chunk_reduce(ForwardIt first, ForwardIt last, T init, BinaryOp op)
+{
+    if constexpr (std::is_arithmetic_v<T> && (std::is_same_v<BinaryOp, std::plus<>> || std::is_same_v<BinaryOp, std::plus<T>>))
+        return std::reduce(std::execution::unseq, first, last, init, op);
+    else
+        return std::accumulate(first, last, std::move(init), op);
+}
+
+// 返回每个块的边界，第 i 个块为 [bounds[i], bounds[i + 1])，划分方式与 sum 相同
+template <typename ForwardIt>
+std::vector<ForwardIt> split_chunks(ForwardIt first, std::size_t distance, std::size_t num_chunks)
+{
+    std::size_t chunk_size = distance / num_chunks;
+    std::size_t remainder = distance % num_chunks;
+
+    std::vector<ForwardIt> bounds{first};
+    for (std::size_t i = 0; i < num_chunks; ++i)
+        bounds.push_back(std::next(bounds.back(), chunk_size + (i < remainder ? 1 : 0)));
+    return bounds;
+}
+
+template <typename ForwardIt1, typename ForwardIt2, typename BinaryOp = std::plus<>>
+ForwardIt2 parallel_inclusive_scan(ForwardIt1 first, ForwardIt1 last, ForwardIt2 d_first, BinaryOp op = {})
+{
+    using value_type = std::iter_value_t<ForwardIt1>;
+    std::size_t num_threads = std::thread::hardware_concurrency();
+    num_threads = num_threads == 0 ? 2 : num_threads;
+    std::ptrdiff_t distance = std::distance(first, last);
+
+    if (distance <= 1024000)
+        return std::inclusive_scan(first, last, d_first, op);
+
+    auto bounds = split_chunks(first, distance, num_threads);
+    auto d_bounds = split_chunks(d_first, distance, num_threads);
+
+    // 第一趟：块内求和。块一定非空，所以用块的首元素作为初值，不要求 op 有单位元
+    std::vector<value_type> totals(num_threads);
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t i = 0; i < num_threads; ++i)
+            threads.emplace_back([&, i]
+                                 { totals[i] = chunk_reduce(std::next(bounds[i]), bounds[i + 1], *bounds[i], op); });
+    } // jthread 析构时 join，保证第一趟全部完成
+
+    // 对块总和做串行扫描，offsets[i] 为第 i 个块之前所有元素的累计值（第 0 个块没有偏移）
+    std::vector<value_type> offsets(num_threads);
+    std::inclusive_scan(totals.begin(), totals.end() - 1, offsets.begin() + 1, op);
+
+    // 第二趟：以偏移为初值做块内扫描。就地扫描（d_first == first）也是安全的，每个线程只读写自己的块
+    {
+        std::vector<std::jthread> threads;
+        threads.emplace_back([&]
+                             { std::inclusive_scan(bounds[0], bounds[1], d_bounds[0], op); });
+        for (std::size_t i = 1; i < num_threads; ++i)
+            threads.emplace_back([&, i]
+                                 { std::inclusive_scan(bounds[i], bounds[i + 1], d_bounds[i], op, offsets[i]); });
+    }
+    return d_bounds.back();
+}
+
+template <typename ForwardIt1, typename ForwardIt2, typename T, typename BinaryOp = std::plus<>>
+ForwardIt2 parallel_exclusive_scan(ForwardIt1 first, ForwardIt1 last, ForwardIt2 d_first, T init, BinaryOp op = {})
+{
+    std::size_t num_threads = std::thread::hardware_concurrency();
+    num_threads = num_threads == 0 ? 2 : num_threads;
+    std::ptrdiff_t distance = std::distance(first, last);
+
+    if (distance <= 1024000)
+        return std::exclusive_scan(first, last, d_first, init, op);
+
+    auto bounds = split_chunks(first, distance, num_threads);
+    auto d_bounds = split_chunks(d_first, distance, num_threads);
+
+    std::vector<T> totals(num_threads);
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t i = 0; i < num_threads; ++i)
+            threads.emplace_back([&, i]
+                                 { totals[i] = chunk_reduce(std::next(bounds[i]), bounds[i + 1], T(*bounds[i]), op); });
+    }
+
+    // offsets[i] = init op totals[0] op ... op totals[i - 1]
+    std::vector<T> offsets(num_threads);
+    std::exclusive_scan(totals.begin(), totals.end(), offsets.begin(), init, op);
+
+    {
+        std::vector<std::jthread> threads;
+        for (std::size_t i = 0; i < num_threads; ++i)
+            threads.emplace_back([&, i]
+                                 { std::exclusive_scan(bounds[i], bounds[i + 1], d_bounds[i], offsets[i], op); });
+    }
+    return d_bounds.back();
+}
+
+template <typename F>
+auto measure(F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// 标准库的 std::inclusive_scan 同样可以指明执行策略。libstdc++ 的并行策略依赖 TBB，编译时需要链接 -ltbb
+int main()
+{
+    // 用法示例：直方图的桶计数经过 exclusive_scan 得到每个桶在输出数组中的起始偏移
+    std::vector<int> counts{3, 0, 2, 5, 1};
+    std::vector<int> bucket_offsets(counts.size());
+    parallel_exclusive_scan(counts.begin(), counts.end(), bucket_offsets.begin(), 0);
+    for (int offset : bucket_offsets)
+        std::cout << offset << ' '; // 0 3 3 5 10
+    std::cout << '\n';
+
+    std::vector<std::string> strs{"a", "b", "c"};
+    std::vector<std::string> prefixes(strs.size());
+    parallel_inclusive_scan(strs.begin(), strs.end(), prefixes.begin());
+    std::cout << prefixes.back() << '\n'; // abc
+
+    std::vector<long long> data(50'000'000);
+    std::iota(data.begin(), data.end(), 0);
+    std::vector<long long> expected(data.size()), result(data.size());
+
+    std::cout << "std::inclusive_scan:            " << measure([&]
+                                                             { std::inclusive_scan(data.begin(), data.end(), expected.begin()); })
+              << " ms\n";
+    std::cout << "std::inclusive_scan(par):       " << measure([&]
+                                                             { std::inclusive_scan(std::execution::par, data.begin(), data.end(), result.begin()); })
+              << " ms\n";
+    std::cout << "parallel_inclusive_scan:        " << measure([&]
+                                                             { parallel_inclusive_scan(data.begin(), data.end(), result.begin()); })
+              << " ms\n";
+    std::cout << std::boolalpha << (result == expected) << '\n';
+
+    std::exclusive_scan(data.begin(), data.end(), expected.begin(), 0LL);
+    std::cout << "parallel_exclusive_scan:        " << measure([&]
+                                                             { parallel_exclusive_scan(data.begin(), data.end(), result.begin(), 0LL); })
+              << " ms\n";
+    std::cout << std::boolalpha << (result == expected) << '\n';
+
+    // 满足结合律但不满足交换律的 op：“取右边的值”的前缀结果就是输入本身
+    parallel_inclusive_scan(data.begin(), data.end(), result.begin(), [](long long, long long b)
+                            { return b; });
+    std::cout << std::boolalpha << (result == data) << '\n';
+}
+
+#elif defined(VERSION_17)
+// 自适应粒度：sum 固定在 distance > 1024000 时才并行，并且总是平均分成 num_threads 块
+/*
+1: 对 std::string 这类昂贵的元素，1024000 的阈值太高，几万个元素就值得并行
+2: 对 int 这类廉价的元素，平均分块后只要有一个线程被调度得慢，其它线程都要等它（掉队者）
+auto_partitioner 的做法：
+1: 采样：先串行处理 64、128、256... 个元素（结果照常计入），直到某一段耗时足够长，得到每个元素的平均耗时
+2: 根据单个元素的耗时计算并行的阈值与块大小，并按调用点（std::source_location）缓存，之后的调用不再采样
+3: 块不再预先分配给线程，线程从一个原子游标中动态领取下一块，先做完的线程多做，从而均衡负载
+*/
+
+class auto_partitioner
+{
+    // 启动并回收一个线程的大致开销，以及希望每块达到的执行时间（纳秒）
+    static constexpr double thread_cost_ns = 50'000;
+    static constexpr double chunk_time_ns = 100'000;
+    // 采样段的耗时至少要达到此值，测量结果才不会被计时精度淹没
+    static constexpr double min_sample_ns = 20'000;
+
+    std::atomic<double> ns_per_element_{0}; // 0 表示尚未测量
+
+public:
+    // 每个调用点一个实例。std::map 的节点地址稳定，返回的引用一直有效
+    static auto_partitioner &at(const std::source_location &loc)
+    {
+        static std::mutex m;
+        static std::map<std::tuple<std::string_view, std::uint_least32_t, std::uint_least32_t>, auto_partitioner> sites;
+        std::lock_guard<std::mutex> lk{m};
+        return sites[{loc.file_name(), loc.line(), loc.column()}];
+    }
+
+    static std::size_t num_threads() noexcept
+    {
+        std::size_t n = std::thread::hardware_concurrency();
+        return n == 0 ? 2 : n;
+    }
+
+    double ns_per_element() const noexcept { return ns_per_element_.load(std::memory_order_relaxed); }
+
+    // p 个线程并行的耗时约为 n * c / p + p * thread_cost，比串行的 n * c 更快时才值得并行
+    std::size_t cutoff() const noexcept
+    {
+        double ns = ns_per_element();
+        std::size_t p = num_threads();
+        if (ns == 0 || p < 2)
+            return std::numeric_limits<std::size_t>::max();
+        return static_cast<std::size_t>(p * thread_cost_ns / (ns * (1 - 1.0 / p)));
+    }
+
+    // 每块大约执行 chunk_time_ns，同时保证每个线程至少能分到 4 块，用于均衡负载
+    std::size_t chunk_size(std::size_t n) const noexcept
+    {
+        double ns = ns_per_element();
+        std::size_t by_time = ns == 0 ? n : static_cast<std::size_t>(chunk_time_ns / ns);
+        std::size_t by_balance = n / (num_threads() * 4);
+        return std::max<std::size_t>(1, std::min(by_time, by_balance));
+    }
+
+    void reset() noexcept { ns_per_element_.store(0, std::memory_order_relaxed); }
+
+    // chunk_reduce(b, e) 计算一块的局部结果，combine 按块的顺序合并，所以 combine 只需要满足结合律
+    template <typename ForwardIt, typename T, typename ChunkReduce, typename Combine>
+    T reduce(ForwardIt first, ForwardIt last, T init, ChunkReduce chunk_reduce, Combine combine)
+    {
+        std::size_t n = std::distance(first, last);
+        std::size_t done = 0;
+
+        if (ns_per_element() == 0)
+        {
+            for (std::size_t block = 64; done < n; block *= 2)
+            {
+                std::size_t count = std::min(block, n - done);
+                auto next = std::next(first, count);
+                auto start = std::chrono::steady_clock::now();
+                init = combine(std::move(init), chunk_reduce(first, next));
+                double elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+                first = next;
+                done += count;
+                if (elapsed >= min_sample_ns)
+                {
+                    ns_per_element_.store(elapsed / count, std::memory_order_relaxed);
+                    break;
+                }
+            }
+        }
+
+        std::size_t rest = n - done;
+        if (rest == 0)
+            return init;
+        if (rest < cutoff())
+            return combine(std::move(init), chunk_reduce(first, last));
+
+        std::size_t chunk = chunk_size(rest);
+        std::size_t num_chunks = (rest + chunk - 1) / chunk;
+        std::size_t num_workers = std::min(num_threads(), num_chunks);
+
+        // 随机访问迭代器可以直接算出第 i 块的起点；前向迭代器只能先走一遍，记录下所有块的边界
+        std::vector<ForwardIt> bounds;
+        if constexpr (!std::random_access_iterator<ForwardIt>)
+        {
+            bounds.push_back(first);
+            for (std::size_t i = 0; i < num_chunks; ++i)
+                bounds.push_back(std::next(bounds.back(), std::min(chunk, rest - i * chunk)));
+        }
+        auto chunk_begin = [&](std::size_t i)
+        {
+            if constexpr (std::random_access_iterator<ForwardIt>)
+                return std::next(first, std::min(rest, i * chunk));
+            else
+                return bounds[i];
+        };
+
+        std::vector<T> partials(num_chunks);
+        std::atomic<std::size_t> cursor{0};
+        auto worker = [&]
+        {
+            // relaxed 即可：每块只会被一个线程领取，结果通过 join 对当前线程可见
+            for (std::size_t i; (i = cursor.fetch_add(1, std::memory_order_relaxed)) < num_chunks;)
+                partials[i] = chunk_reduce(chunk_begin(i), chunk_begin(i + 1));
+        };
+        {
+            std::vector<std::jthread> threads;
+            for (std::size_t i = 1; i < num_workers; ++i)
+                threads.emplace_back(worker);
+            worker(); // 当前线程也参与领取
+        }
+
+        for (auto &partial : partials)
+            init = combine(std::move(init), std::move(partial));
+        return init;
+    }
+};
+
+// 默认实参 std::source_location::current() 在调用点求值，因此每个调用点各自缓存测量结果
+template <typename ForwardIt>
+auto sum(ForwardIt first, ForwardIt last, std::source_location loc = std::source_location::current())
+{
+    using value_type = std::iter_value_t<ForwardIt>;
+    return auto_partitioner::at(loc).reduce(
+        first, last, value_type{}, [](ForwardIt b, ForwardIt e)
+        { return std::accumulate(b, e, value_type{}); },
+        std::plus<>{});
+}
+
+// 原来的 sum：平均分块，用于对比
+template <typename ForwardIt, typename T>
+T even_sum(ForwardIt first, ForwardIt last, T init)
+{
+    std::size_t num_threads = auto_partitioner::num_threads();
+    std::ptrdiff_t distance = std::distance(first, last);
+    std::size_t chunk_size = distance / num_threads;
+    std::size_t remainder = distance % num_threads;
+
+    std::vector<T> results(num_threads);
+    {
+        std::vector<std::jthread> threads;
+        auto start = first;
+        for (std::size_t i = 0; i < num_threads; ++i)
+        {
+            auto end = std::next(start, chunk_size + (i < remainder ? 1 : 0));
+            threads.emplace_back([start, end, &results, i]
+                                 { results[i] = std::accumulate(start, end, T{}); });
+            start = end;
+        }
+    }
+    return std::accumulate(results.begin(), results.end(), init);
+}
+
+// 每个元素的耗时与值成正比，平均分块时最后一块的线程要做最多的工作
+struct skewed
+{
+    int n{};
+    friend double operator+(double acc, const skewed &s)
+    {
+        double x = 0;
+        for (int i = 0; i < s.n; ++i)
+            x += std::sqrt(static_cast<double>(i));
+        return acc + x;
+    }
+};
+
+template <typename F>
+double measure(F f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main()
+{
+    std::vector<std::string> strs;
+    for (std::size_t i = 0; i < 200'000; ++i)
+        strs.push_back(std::to_string(i));
+
+    std::string expected = std::accumulate(strs.begin(), strs.end(), std::string{});
+    std::string result;
+    auto loc = std::source_location::current();
+    for (int i = 0; i < 3; ++i) // 第一次调用采样，之后直接使用缓存
+        std::cout << "string sum: " << measure([&]
+                                               { result = sum(strs.begin(), strs.end(), loc); })
+                  << " ms\n";
+    auto &string_site = auto_partitioner::at(loc);
+    std::cout << "  ns/element: " << string_site.ns_per_element() << ", cutoff: " << string_site.cutoff()
+              << ", chunk: " << string_site.chunk_size(strs.size()) << ", " << std::boolalpha << (result == expected) << '\n';
+
+    std::list<int> list(1'000'000, 1); // 前向（双向）迭代器同样适用
+    std::cout << "list sum: " << sum(list.begin(), list.end()) << '\n';
+
+    std::vector<skewed> work(20'000);
+    for (std::size_t i = 0; i < work.size(); ++i)
+        work[i].n = static_cast<int>(i / 4);
+    double even = 0, dynamic = 0;
+    std::cout << "skewed even_sum: " << measure([&]
+                                                { even = even_sum(work.begin(), work.end(), 0.0); })
+              << " ms\n";
+    std::cout << "skewed auto:     " << measure([&]
+                                                { dynamic = auto_partitioner::at(std::source_location::current()).reduce(work.begin(), work.end(), 0.0, [](auto b, auto e)
+                                                                                                                        { return std::accumulate(b, e, 0.0); },
+                                                                                                                        std::plus<>{}); })
+              << " ms\n";
+    std::cout << (std::abs(even - dynamic) < 1e-6 * even) << '\n';
+}
+
 #endif
\ No newline at end of file